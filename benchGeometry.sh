@@ -0,0 +1,56 @@
+#!/bin/bash
+
+# Builds testit for each geometry of MY_ALLOC_GEOMETRY_LIST (see CMakeLists.txt) and runs them on the same profiles.
+# Prints runtime per operation and relative size overhead (touched) for each geometry and profile, and the mean of
+# each geometry over all profiles. Extra arguments go to cmake, e.g. -DMY_ALLOC_GEOMETRY_LIST="8k:8192:4;16k:16384:2".
+
+BUILD="build-geometry"
+FILE="GeometryResults-$(git rev-parse --short HEAD).txt"
+
+seeds=(1 2 3)
+count=200000
+profiles=("uniform oneinthree random" "normal1 cluster random" "fixed104 oneinthree random"
+    "increase cluster random" "powerlaw oneinthree random" "powerlaw cluster lifetime"
+    "bimodal oneinthree random" "bimodal cluster generational")
+
+cmake -S . -B ${BUILD} -DCMAKE_BUILD_TYPE=Release -DMY_ALLOC_GEOMETRIES=ON "$@" > /dev/null || exit 1
+cmake --build ${BUILD} -j"$(nproc)" > /dev/null || exit 1
+geometries=$(cd ${BUILD} && ls testit-* | grep -v perf | sed 's/testit-//')
+
+printf "Results will be saved in $FILE\n\n"
+printf "%-10s %-32s %12s %12s\n" "geometry" "profile" "us/op" "overhead" | tee ${FILE}
+
+for GEOMETRY in ${geometries}
+do
+    for PROFILE in "${profiles[@]}"
+    do
+        for SEED in "${seeds[@]}"
+        do
+            RES=$(${BUILD}/testit-${GEOMETRY} ${SEED} ${count} ${PROFILE})
+            RUNTIME=$(echo "$RES" | grep 'Runtime' | grep -o -E -e '[+\-\.0-9]*$')
+            OVERHEAD=$(echo "$RES" | grep 'overhead (touched):' | grep -o -E -e '[+\-\.0-9]*$')
+            echo "${GEOMETRY}|${PROFILE}|${RUNTIME}|${OVERHEAD}"
+        done
+    done
+done | awk -F '|' '
+    # Mean over the seeds of each profile, then over the profiles of each geometry
+    function flush() {
+        if (runs) {
+            printf "%-10s %-32s %12.4f %12.4f\n", geometry, profile, runtime / runs, overhead / runs
+            runtimes += runtime / runs; overheads += overhead / runs; profiles++
+        }
+        runtime = overhead = runs = 0
+    }
+    function mean() {
+        flush()
+        if (profiles) {
+            printf "%-10s %-32s %12.4f %12.4f\n\n", geometry, "mean", runtimes / profiles, overheads / profiles
+        }
+        runtimes = overheads = profiles = 0
+    }
+    $1 != geometry { mean() }
+    $2 != profile { flush() }
+    { geometry = $1; profile = $2; runtime += $3; overhead += $4; runs++ }
+    END { mean() }' | tee -a ${FILE}
+
+exit 0;
@@ -0,0 +1,276 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "my_alloc_internal.h"
+
+// Microbenchmarks for single code paths of the allocator.
+// Each benchmark builds a heap state in which every timed operation takes the same path, then times a batch of
+// those operations. It runs in a process of its own, so it starts with a fresh heap and does not depend on the
+// benchmarks before it.
+
+#define MAX_OPS 4096
+#define DEFAULT_RUNS 50
+
+// Sizes above BITMAP_MAX_SIZE, so they are served from tagged pages
+#define OBJECT_SIZE 128
+// Large enough for SPLIT_SIZE, the remainder is too small for another one
+#define SPLIT_FROM 264
+#define SPLIT_SIZE 136
+// Keeps objects apart so freeing them does not coalesce
+#define GUARD_SIZE 72
+// Two blocks with the span header
+#define SPAN_SIZE (2 * BLOCKSIZE - 16)
+
+typedef struct benchmark {
+    const char *name;
+    const char *description;
+    int ops;
+    void (*setup)();
+    void (*run)();  // Timed, ops operations
+    void (*teardown)();
+} benchmark;
+
+static int ops;
+static void *objects[MAX_OPS];
+static void *guards[MAX_OPS];
+static void *left[MAX_OPS];
+static void *right[MAX_OPS];
+// Objects the setup could not use, freed by the teardown
+static void *spare[4 * MAX_OPS];
+static int spares;
+
+static void nothing() {
+}
+
+static void freeAll(void **array, int n) {
+    for (int i = 0; i < n; ++i) {
+        my_free(array[i]);
+    }
+}
+
+// Objects of size with a guard after each
+static void allocGuarded(size_t size) {
+    for (int i = 0; i < ops; ++i) {
+        objects[i] = (my_alloc)(size);
+        guards[i] = (my_alloc)(GUARD_SIZE);
+    }
+}
+
+static void freeObjectsAndGuards() {
+    freeAll(objects, ops);
+    freeAll(guards, ops);
+}
+
+static void freeGuards() {
+    freeAll(guards, ops);
+}
+
+static void freeObjects() {
+    freeAll(objects, ops);
+}
+
+// Exact fit: pop the head of a bucket
+static void setupPop() {
+    allocGuarded(OBJECT_SIZE);
+    freeAll(objects, ops);
+}
+
+static void runPop() {
+    for (int i = 0; i < ops; ++i) {
+        objects[i] = (my_alloc)(OBJECT_SIZE);
+    }
+}
+
+static void runPopInline() {
+    for (int i = 0; i < ops; ++i) {
+        objects[i] = my_alloc(OBJECT_SIZE);
+    }
+}
+
+// Take a larger free space and insert the remainder into its bucket
+static void setupSplit() {
+    allocGuarded(SPLIT_FROM);
+    freeAll(objects, ops);
+}
+
+static void runSplit() {
+    for (int i = 0; i < ops; ++i) {
+        objects[i] = (my_alloc)(SPLIT_SIZE);
+    }
+}
+
+// Free with both neighbours in use
+static void setupPush() {
+    allocGuarded(OBJECT_SIZE);
+}
+
+static void runFree() {
+    for (int i = 0; i < ops; ++i) {
+        my_free(objects[i]);
+    }
+}
+
+// Defer and reclaim with no reader in a read section, the batches are freed as they fill
+static void runFreeDeferred() {
+    for (int i = 0; i < ops; ++i) {
+        my_free_deferred(objects[i]);
+    }
+    my_epoch_reclaim();
+}
+
+// Free with free spaces on both sides: objects[i] lies between left[i] and right[i], which are freed before
+static void setupCoalesce() {
+    spares = 0;
+    for (int i = 0; i < ops;) {
+        left[i] = (my_alloc)(OBJECT_SIZE);
+        objects[i] = (my_alloc)(OBJECT_SIZE);
+        right[i] = (my_alloc)(OBJECT_SIZE);
+        guards[i] = (my_alloc)(GUARD_SIZE);
+        size_t step = OBJECT_SIZE + sizeof(header);
+        if (objects[i] == left[i] + step && right[i] == objects[i] + step) {
+            ++i;
+        } else {
+            // Crosses a page boundary
+            spare[spares++] = left[i];
+            spare[spares++] = objects[i];
+            spare[spares++] = right[i];
+            spare[spares++] = guards[i];
+        }
+    }
+    freeAll(left, ops);
+    freeAll(right, ops);
+}
+
+static void teardownCoalesce() {
+    freeAll(guards, ops);
+    freeAll(spare, spares);
+}
+
+// No free space fits and there is no empty page: initNewPage
+static void runPage() {
+    for (int i = 0; i < ops; ++i) {
+        objects[i] = (my_alloc)(PAGE_SPACE);
+    }
+}
+
+// No free space fits, take a page from emptyPages
+static void setupEmptyPage() {
+    runPage();
+    freeAll(objects, ops);
+}
+
+// Runs of 1 to 8 granules on bitmap pages
+static void runBitmapAlloc() {
+    for (int i = 0; i < ops; ++i) {
+        objects[i] = (my_alloc)(8 * (1 + i % 8));
+    }
+}
+
+// Split two blocks off a free span
+static void runSpanAlloc() {
+    for (int i = 0; i < ops; ++i) {
+        objects[i] = (my_alloc)(SPAN_SIZE);
+    }
+}
+
+static benchmark benchmarks[] = {
+        {"pop", "exact fit from a bucket", MAX_OPS, setupPop, runPop, freeObjectsAndGuards},
+        {"pop-inline", "exact fit, constant size inline path", MAX_OPS, setupPop, runPopInline, freeObjectsAndGuards},
+        {"split", "split a free space, reinsert the remainder", MAX_OPS, setupSplit, runSplit, freeObjectsAndGuards},
+        {"free", "free between objects in use", MAX_OPS, setupPush, runFree, freeGuards},
+        {"free-deferred", "my_free_deferred, reclaimed in batches", MAX_OPS, setupPush, runFreeDeferred, freeGuards},
+        {"coalesce", "free between two free spaces", MAX_OPS, setupCoalesce, runFree, teardownCoalesce},
+        {"empty-page", "take a page from emptyPages", 256, setupEmptyPage, runPage, freeObjects},
+        // Keeps its pages, so every run has to get new ones
+        {"new-page", "initNewPage with a block from the system", 256, nothing, runPage, nothing},
+        {"bitmap-alloc", "allocate 8 to 64 bytes from bitmap pages", MAX_OPS, nothing, runBitmapAlloc, freeObjects},
+        {"bitmap-free", "free 8 to 64 bytes on bitmap pages", MAX_OPS, runBitmapAlloc, runFree, nothing},
+        {"span-alloc", "split a span for a medium object", 256, nothing, runSpanAlloc, freeObjects},
+        {"span-free", "free a medium object, coalesce its span", 256, runSpanAlloc, runFree, nothing},
+};
+
+#define BENCHMARKS (sizeof(benchmarks) / sizeof(benchmark))
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// Runs one benchmark in this process and prints ns per operation over the runs (after one warm up run)
+static void measure(benchmark *b, int runs) {
+    init_my_alloc();
+    ops = b->ops;
+    double sum = 0;
+    double squares = 0;
+    double min = INFINITY;
+    for (int r = -1; r < runs; ++r) {
+        b->setup();
+        double start = now();
+        b->run();
+        double ns = (now() - start) / ops;
+        b->teardown();
+        if (r >= 0) {
+            sum += ns;
+            squares += ns * ns;
+            min = ns < min ? ns : min;
+        }
+    }
+    double mean = sum / runs;
+    double stddev = runs > 1 ? sqrt((squares - runs * mean * mean) / (runs - 1)) : 0;
+    printf("%-14s %9.2f %9.2f %9.2f   %s\n", b->name, mean, stddev, min, b->description);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-r runs] [benchmark ...]\n  Benchmarks:", name);
+    for (size_t i = 0; i < BENCHMARKS; ++i) {
+        fprintf(stderr, " %s", benchmarks[i].name);
+    }
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int runs = DEFAULT_RUNS;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:")) != -1) {
+        if (opt == 'r' && atoi(optarg) > 0) {
+            runs = atoi(optarg);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    for (int i = optind; i < argc; ++i) {
+        size_t j = 0;
+        while (j < BENCHMARKS && strcmp(argv[i], benchmarks[j].name) != 0) {
+            ++j;
+        }
+        if (j == BENCHMARKS) {
+            usage(argv[0]);
+        }
+    }
+
+    printf("%-14s %9s %9s %9s   (ns per operation, %d runs)\n", "path", "mean", "stddev", "min", runs);
+    fflush(stdout);
+    for (size_t i = 0; i < BENCHMARKS; ++i) {
+        int selected = optind == argc;
+        for (int j = optind; j < argc; ++j) {
+            selected |= strcmp(argv[j], benchmarks[i].name) == 0;
+        }
+        if (!selected) {
+            continue;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            measure(&benchmarks[i], runs);
+            exit(0);
+        }
+        waitpid(pid, 0, 0);
+    }
+    return 0;
+}
@@ -1,20 +1,12 @@
+#include <sched.h>
 #include <stdlib.h>
-#include <stdio.h>
 #include <stdint.h>
+#include <unistd.h>
 
-#include "my_alloc.h"
-#include "my_system.h"
+#include "my_alloc_internal.h"
 
-#define NUMBER_OF_BUCKETS 32
-
-typedef void page;
-
-// Doublepointer: To fit a doubly linked list in 8 byte objects we only store the lower 32bit of each pointer.
-
-typedef void *doublePointer;
-
-// High 32 bit of pointer
-uintptr_t pointerPrefix;
+// Start of the 4 GiB window all blocks lie in, free list links are 32 bit offsets against it
+uintptr_t pointerBase;
 
 // Some useful bitmasks
 #define LOW32 0x00000000ffffffff
@@ -25,46 +17,96 @@ uintptr_t pointerPrefix;
 // This is necessary to differentiate between nullpointer and first byte of first block.
 #define DOUBLENULL ((doublePointer) 0x0000000100000001)
 
-// Bucket contains first element of linked list of free spaces of size 8 * (n + 1)
-// Last bucket may contain larger free spaces.
-doublePointer *buckets[NUMBER_OF_BUCKETS];
+// Part of the window of pointerBase above the first block, for blocks the system places higher later on
+#define WINDOW_ABOVE ((uintptr_t) 1 << 29)
 
-//#define DEBUG
+// Spaces of the bucket of a size that findFreeSpace looks at before it rounds the size up to the next bucket
+#define BUCKET_WALK 16
 
-#ifdef DEBUG
-#define DEBUG_PAGE_INIT
-#define DEBUG_ALLOC
-#define DEBUG_GETBLOCK
-#define DEBUG_FREE
-#define DEBUG_REMOVE_LIST
-#define DEBUG_DOUBLEPOINTER
-#define DEBUG_USED
-#endif
+struct freeLists defaultLists;
+struct freeLists *heapLists = &defaultLists;
+
+void *(*blockSource)() = get_block_from_system;
+
+// Maximum number of bytes to take from blockSource, 0 for no limit
+size_t budget = 0;
+size_t blocksTaken = 0;
+
+// Called when the budget is used up
+int (*pressureCallback)(size_t size) = 0;
+
+// Empty pages given back against the budget, linked through their first word. newBlock takes them first.
+static void *releasedBlocks = 0;
+
+// Pauses between two looks at a taken lock before the thread yields
+#define SPIN_MAX_BACKOFF 1024
+
+// Set by my_alloc_threadsafe: all entry points take allocLock
+int threadSafe = 0;
+static int allocLock = 0;
+
+// Set while the compactor moves objects
+int noNewPages = 0;
+
+static struct my_alloc_stats localStats = {
+        .magic = MY_ALLOC_STATS_MAGIC, .blockSize = BLOCKSIZE, .pools = NUMBER_OF_POOLS, .lists = NUMBER_OF_LISTS};
+struct my_alloc_stats *allocStats = &localStats;
+
+uint32_t frames[1 << (32 - FRAME_SHIFT)];
 
-#ifdef DEBUG_USED
-long int sumUsed = 0;
-long int sumAvailiable = 0;
+// Tells the core that this is a spin loop, so it doesn't speculate ahead and leaves resources to its sibling
+static inline void spinPause() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
 #endif
+}
 
-// Each 8 byte header stores the size of the object before and after it.
+void spinLock(int *lock) {
+    int backoff = 1;
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+        // Spin on a plain load to keep the cache line shared. The pauses between two looks double, so waiting
+        // threads don't all go for the line the moment it is released. Give up the CPU if it takes long.
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+            if (backoff > SPIN_MAX_BACKOFF) {
+                sched_yield();
+                continue;
+            }
+            for (int i = 0; i < backoff; ++i) {
+                spinPause();
+            }
+            backoff <<= 1;
+        }
+    }
+}
+
+void lockAlloc() {
+    if (threadSafe) {
+        spinLock(&allocLock);
+    }
+}
 
-// Header of 0: end of page
-#define END_OF_PAGE 0
-// Footer of 0: start of page
-#define START_OF_PAGE 0
-// LSB == 1: space not occupied
-typedef struct header {
-    uint32_t tailingObjectSize;  // Footer of preceding object
-    uint32_t precedingObjectSize;  // Header of following object
-} header;
+void unlockAlloc() {
+    if (threadSafe) {
+        __atomic_store_n(&allocLock, 0, __ATOMIC_RELEASE);
+    }
+}
+
+// Each 8 byte header stores the size of the object before and after it.
+// Bits 1 and 2 of tailingObjectSize (header of an object) store the pool the object belongs to.
 
 header *headerOf(void *object) {
     return object - sizeof(header);
 }
 
-// Removes occupancy information from header if present
+// Removes occupancy and pool information from header if present
 uint32_t realSize(uint32_t s) {
-    return ~(~s | (uint32_t) 1);
+    return s & ~(uint32_t) 7;
+}
+
+uint32_t poolOf(uint32_t s) {
+    return (s & POOL_BITS) >> POOL_SHIFT;
 }
 
 header *footerOf(void *object) {
@@ -76,47 +118,58 @@ void *firstPointer(doublePointer d) {
     if (((uintptr_t) d >> 32) & 1) {
         return 0;
     }
-    return (void *) ((uintptr_t) d >> 32 | pointerPrefix);
+    return (void *) (((uintptr_t) d >> 32) + pointerBase);
 }
 
 void *secondPointer(doublePointer d) {
     if ((uintptr_t) d & 1) {
         return 0;
     }
-    return (void *) (((uintptr_t) d & LOW32) | pointerPrefix);
+    return (void *) (((uintptr_t) d & LOW32) + pointerBase);
 }
 
 void setFirst(doublePointer *d, void *p) {
-    if (p == 0) {
-        p = (void *) 1;
-    }
-    *d = (doublePointer) (((uintptr_t) *d & LOW32) | ((uintptr_t) p << 32));
-#ifdef DEBUG_DOUBLEPOINTER
-    printf("[SETFIRST] Writing to %p\n", d);
-#endif
+    uintptr_t offset = p ? (uintptr_t) p - pointerBase : 1;
+    *d = (doublePointer) (((uintptr_t) *d & LOW32) | offset << 32);
 }
 
 void setSecond(doublePointer *d, void *p) {
-    if (p == 0) {
-        p = (void *) 1;
+    uintptr_t offset = p ? (uintptr_t) p - pointerBase : 1;
+    *d = (doublePointer) (((uintptr_t) *d & HIGH32) | (offset & LOW32));
+}
+
+// Bucket for free spaces of the given object size, up to PAGE_SPACE
+int bucketIndex(uint32_t size) {
+    return sizeClassOf[(size >> 3) - 1];
+}
+
+// Removes a free space from the start of the list it belongs to, s is its header
+void setListHead(uint32_t s, doublePointer *following) {
+    if (realSize(s) == PAGE_SPACE) {
+        heapLists->emptyPages = following;
+        return;
+    }
+    int pool = poolOf(s);
+    int index = bucketIndex(realSize(s));
+    heapLists->buckets[pool][index] = following;
+    if (following == 0) {
+        heapLists->nonEmptyBuckets[pool] &= ~((uint64_t) 1 << index);
     }
-    *d = (doublePointer) (((uintptr_t) *d & HIGH32) | ((uintptr_t) p & LOW32));
-#ifdef DEBUG_DOUBLEPOINTER
-    printf("[SETSECOND] Writing to %p\n", d);
-#endif
 }
 
 // Removes free space from the list it belongs to
 void removeFreeSpaceFromList(doublePointer *p) {
-#ifdef DEBUG_REMOVE_LIST
-    printf("[REMOVE_LIST] Called for %p\n", p);
-#endif
     doublePointer *prevObject = firstPointer(*p);
     doublePointer *followingObject = secondPointer(*p);
 
-#ifdef DEBUG_REMOVE_LIST
-    printf("[REMOVE_LIST] Previous listelement is %p, following is %p\n", prevObject, followingObject);
-#endif
+    uint32_t s = headerOf(p)->tailingObjectSize;
+    if (realSize(s) == PAGE_SPACE) {
+        allocStats->emptyPages--;
+        TRACE(REMOVE, p, PAGE_SPACE, poolOf(s), NUMBER_OF_LISTS);
+    } else {
+        allocStats->freeSpaces[poolOf(s)][bucketIndex(realSize(s))]--;
+        TRACE(REMOVE, p, realSize(s), poolOf(s), bucketIndex(realSize(s)));
+    }
 
     if (prevObject == 0) {
         // Space is at start of list
@@ -124,12 +177,7 @@ void removeFreeSpaceFromList(doublePointer *p) {
             setFirst(followingObject, 0);
         }
 
-        int size = headerOf(p)->tailingObjectSize;
-        int index = (size / 8) - 1;
-        if (index >= NUMBER_OF_BUCKETS) {
-            index = NUMBER_OF_BUCKETS - 1;
-        }
-        buckets[index] = followingObject;
+        setListHead(s, followingObject);
     } else {
         setSecond(prevObject, followingObject);
 
@@ -140,231 +188,374 @@ void removeFreeSpaceFromList(doublePointer *p) {
     }
 }
 
-#ifdef DEGUB_USED
-void printUsed() {
-    printf("Used: %f%%\n", 100 * (double) sumUsed / sumAvailiable);
+int inLinkWindow(void *start, size_t size) {
+    if (!pointerBase) {
+        // mmap hands out addresses top down, so most of the window goes below the first block
+        uintptr_t top = (uintptr_t) start + WINDOW_ABOVE;
+        pointerBase = top > LINK_WINDOW ? top - LINK_WINDOW : 0;
+    }
+    return (uintptr_t) start - pointerBase <= LINK_WINDOW - size;
 }
-#endif
 
 /**
- * Initializes page with header + footer
- * @return Pointer to start (header) of initialized page
+ * Gets a new block of BLOCKSIZE bytes from blockSource
+ * @return Pointer to start of the block, 0 if the budget is used up, the system is out of memory or the block lies
+ * outside the window of pointerBase
  */
-page *initNewPage() {
-    void *ret = get_block_from_system();
-
-#ifdef DEGUB_USED
-    sumAvailiable += BLOCKSIZE;
-#endif
-
-    if (!pointerPrefix) {
-        // Lets assume the first 32 bits in every pointer are equal...
-        // (https://www.youtube.com/watch?v=gY2k8_sSTsE)
-        pointerPrefix = (uintptr_t) ret & HIGH32;
-#ifdef DEBUG_DOUBLEPOINTER
-        printf("[PTR] Set prefix to %lx\n", (unsigned long) pointerPrefix);
-#endif
+void *newBlock() {
+    if (budget && (blocksTaken + 1) * BLOCKSIZE > budget) {
+        return 0;
     }
 
-#if defined(DEBUG_PAGE_INIT) || defined(DEBUG_GETBLOCK)
-    printf("[PAGE INIT] New block: %p (Size: %d)\n", ret, BLOCKSIZE);
-#endif
-
+    void *ret;
+    if (releasedBlocks && blockSource == get_block_from_system) {
+        // Released blocks came from the system, not from a heap file
+        ret = releasedBlocks;
+        releasedBlocks = *(void **) ret;
+    } else {
+        ret = blockSource();
 
-    if (!ret) {
-        puts("\033[92m[ERROR] --> initNewPage: OUT OF MEMORY\033[0m");
-        exit(1);
+        if (!ret) {
+            // Out of memory
+            return 0;
+        }
+        if (!inLinkWindow(ret, BLOCKSIZE)) {
+            // The free list links can't reach it. The block stays with the system, counted by get_sys_blockcount.
+            return 0;
+        }
     }
+    blocksTaken++;
+    allocStats->blocksTaken = blocksTaken;
+    allocStats->newPages++;
+    allocStats->systemBlocks = get_sys_blockcount();
+    TRACE(NEW_PAGE, ret, BLOCKSIZE, 0, 0);
 
+    return ret;
+}
+
+/**
+ * Writes header + footer to a block, turning it into a page with a single free space.
+ * The free space is not put into any list.
+ */
+void formatPage(page *p) {
     //Header an den Anfang der Page setzen
-    header *head = headerOf(ret + sizeof(header));
-    head->tailingObjectSize = (BLOCKSIZE - 2 * sizeof(header)) | 1;
+    header *head = headerOf(p + sizeof(header));
+    head->tailingObjectSize = PAGE_SPACE | 1;
     head->precedingObjectSize = START_OF_PAGE;
 
     //"Footer" (header verwendet als Footer) an den Ende der Page setzen
-    header *foot = footerOf(ret + sizeof(header));
+    header *foot = footerOf(p + sizeof(header));
     foot->precedingObjectSize = head->tailingObjectSize;
     foot->tailingObjectSize = END_OF_PAGE;
 
     // "First and last" element
-    *((doublePointer *) (ret + sizeof(header))) = DOUBLENULL;
-
-#ifdef DEBUG_PAGE_INIT
-    printf("[PAGE INIT] Done init page for objectsize %d.\n", head->tailingObjectSize);
-#endif
+    *((doublePointer *) (p + sizeof(header))) = DOUBLENULL;
+}
 
+/**
+ * Initializes page with header + footer
+ * @return Pointer to start (header) of initialized page
+ */
+page *initNewPage() {
+    page *ret = newBlock();
+    if (ret) {
+        formatPage(ret);
+    }
     return ret;
 }
 
-void init_my_alloc() {
+/**
+ * Hands memory the allocator keeps for other purposes back to the free lists:
+ * Frees deferred objects no reader can see anymore, turns runs without spans in use into empty pages and compacts
+ * movable objects to empty some pages.
+ * @return Whether anything was reclaimed
+ */
+static int reclaim() {
+    int freed = reclaimDeferred();
+    freed |= releaseSpanRuns() > 0;
+    return compact(16) > 0 || freed;
 }
 
+/**
+ * Makes memory available for an allocation of size that failed: reclaims what the allocator holds back itself, then
+ * asks the pressure callback, which runs without the lock.
+ * @return Whether the allocation is worth trying again
+ */
+int makeRoom(size_t size) {
+    if (reclaim()) {
+        return 1;
+    }
+    if (!pressureCallback) {
+        return 0;
+    }
+    // The callback may call my_free
+    unlockAlloc();
+    int freed = pressureCallback(size);
+    lockAlloc();
+    return freed;
+}
 
-void *my_alloc(size_t size) {
-#ifdef DEBUG_ALLOC
-    printf("\033[96m[ALLOC] Allocating %ld bytes\n\033[0m", size);
-#endif
+/**
+ * Takes up to count empty pages out of the lists and gives them back against the budget, for spans, which need
+ * adjacent blocks. Their memory is released except for the link to the next one. newBlock takes them again.
+ * @return Number of pages given back
+ */
+size_t releaseEmptyPages(size_t count) {
+    size_t systemPage = (size_t) sysconf(_SC_PAGESIZE);
+    size_t released = 0;
+    for (; released < count && defaultLists.emptyPages; ++released) {
+        void *block = (void *) defaultLists.emptyPages - sizeof(header);
+        removeFreeSpaceFromList(defaultLists.emptyPages);
+        *(void **) block = releasedBlocks;
+        releasedBlocks = block;
+        if (systemPage < BLOCKSIZE) {
+            // The link stays
+            releaseMemory(block + systemPage, BLOCKSIZE - systemPage);
+        }
+    }
+    blocksTaken -= released;
+    allocStats->blocksTaken = blocksTaken;
+    return released;
+}
 
-#ifdef DEBUG_USED
-    sumUsed += size;
-    printUsed();
-#endif
+// Puts a free space at the start of the list (bucket) its header says it belongs to
+void insertFreeSpace(void *ptr) {
+    uint32_t s = headerOf(ptr)->tailingObjectSize;
+    doublePointer **list = &heapLists->emptyPages;
+    int index = NUMBER_OF_LISTS;
+    if (realSize(s) == PAGE_SPACE && poolOf(s) == MOVABLE_POOL) {
+        // Page leaves the movable pool
+        unregisterMovablePage(ptr - sizeof(header));
+    } else if (realSize(s) != PAGE_SPACE) {
+        index = bucketIndex(realSize(s));
+        list = &heapLists->buckets[poolOf(s)][index];
+        heapLists->nonEmptyBuckets[poolOf(s)] |= (uint64_t) 1 << index;
+        allocStats->freeSpaces[poolOf(s)][index]++;
+    }
+    if (list == &heapLists->emptyPages) {
+        allocStats->emptyPages++;
+    }
 
-    // Use the first free space large enough to fit the required size.
-    // Insert remaining space in corresponding list (bucket)
+    // Has no previous free space
+    setFirst(ptr, 0);
+    // Following free space is whatever is currently at the start
+    setSecond(ptr, *list);
 
-    // Pointer to allocated space
-    void *object = 0;
+    // If the list wasn't empty before, point it to the new start
+    if (*list != 0) {
+        setFirst(*list, ptr);
+    }
+
+    // Start of list is this free space
+    *list = ptr;
+    TRACE(INSERT, ptr, realSize(s), poolOf(s), index);
+}
+
+void init_my_alloc() {
+}
 
-    // Search all buckets (beginning with smallest usable size) for one that has a free space:
-    int i = (int) ((size >> 3) - 1);
-    while (i < NUMBER_OF_BUCKETS - 1 && buckets[i] == 0) {
-        ++i;
+void my_alloc_set_budget(size_t bytes) {
+    budget = bytes;
+}
+
+void my_alloc_set_pressure_callback(int (*callback)(size_t size)) {
+    pressureCallback = callback;
+}
+
+size_t my_alloc_trim() {
+    size_t systemPage = (size_t) sysconf(_SC_PAGESIZE);
+    size_t released = 0;
+    lockAlloc();
+    for (doublePointer *space = defaultLists.emptyPages; space && systemPage < BLOCKSIZE; space = secondPointer(*space)) {
+        // The header and the list links stay. The footer reads back as END_OF_PAGE and 0, splitFreeSpace writes it
+        // before anything on the page looks at it.
+        void *block = (void *) space - sizeof(header);
+        if (releaseMemory(block + systemPage, BLOCKSIZE - systemPage) == 0) {
+            released += BLOCKSIZE - systemPage;
+        }
     }
+    unlockAlloc();
+    return released;
+}
 
-    object = buckets[i];
+void my_alloc_threadsafe(int enable) {
+    threadSafe = enable;
+}
 
 
-    if (object == 0) {
+/**
+ * Searches the buckets of the pool for a free space of at least size: the bucket of the size, then the smallest bucket
+ * whose spaces all fit.
+ * If there is none, uses an empty page or gets a new one. If that fails, tries to make memory available and
+ * searches again, unless the lists are those of a my_heap.
+ * @return Free space, still in its list, 0 if out of memory
+ */
+void *findFreeSpace(size_t size, int pool) {
+    void *object = 0;
+    doublePointer **poolBuckets = heapLists->buckets[pool];
+    int first = bucketIndex((uint32_t) size);
+    // From this bucket on every space fits. If the bucket of the size holds smaller spaces too, the first of its spaces
+    // are tried before the size is rounded up to the next bucket. All of them are only walked when no other bucket helps.
+    int fits = size > sizeClassStart[first] ? first + 1 : first;
+    int i = -1;
+    while (1) {
+        uint64_t nonEmpty = heapLists->nonEmptyBuckets[pool];
+        uint64_t candidates = fits < 64 ? nonEmpty & ~(((uint64_t) 1 << fits) - 1) : 0;
+        object = 0;
+        i = -1;
+        if (fits != first && nonEmpty >> first & 1) {
+            object = poolBuckets[first];
+            for (int n = 1; object != 0 && realSize(headerOf(object)->tailingObjectSize) < size; ++n) {
+                object = n < BUCKET_WALK || !candidates ? secondPointer(*(doublePointer *) object) : 0;
+            }
+            i = object ? first : -1;
+        }
+        if (!object && candidates) {
+            i = __builtin_ctzll(candidates);
+            object = poolBuckets[i];
+        }
+        if (object != 0) {
+            break;
+        }
+
         // Did not find a space large enough.
-        // New Page
+        // Empty or new Page
 
-#ifdef DEBUG_ALLOC
-        printf("[ALLOC] Did not find space. Requesting new page.\n");
-#endif
+        if (noNewPages) {
+            return 0;
+        }
+
+        if (heapLists->emptyPages) {
+            object = heapLists->emptyPages;
+            if (pool == MOVABLE_POOL) {
+                registerMovablePage(object - sizeof(header));
+            }
+            break;
+        }
+
+        void *newPage = heapLists == &defaultLists ? initNewPage() : heapPage();
+        if (newPage) {
+            insertFreeSpace(newPage + sizeof(header));
+            object = heapLists->emptyPages;
+            if (pool == MOVABLE_POOL) {
+                registerMovablePage(newPage);
+            }
+            break;
+        }
 
-        void *newPage = initNewPage();
+        // Memory made available this way goes to the lists of my_alloc, a my_heap does not get it
+        if (heapLists == &defaultLists && makeRoom(size)) {
+            continue;
+        }
 
-        buckets[NUMBER_OF_BUCKETS - 1] = newPage + sizeof(header);
-        object = buckets[NUMBER_OF_BUCKETS - 1];
+        TRACE(OUT_OF_MEMORY, 0, size, pool, first);
+        return 0;
+    }
+    if (i > fits) {
+        TRACE(BUCKET_MISS, object, size, pool, first);
     }
+    return object;
+}
 
+/**
+ * Places an object of size in the pool at the start of a free space that is in no list.
+ * @return What is left of the free space, in no list either. 0 if nothing is left.
+ */
+void *splitFreeSpace(void *object, size_t size, int pool) {
     header *objectHeader = headerOf(object);
     header *objectFooter;
 
     // We may have a space that is larger than what we need
-    int availableObjectSize = realSize(objectHeader->tailingObjectSize);
-
-#ifdef DEBUG_ALLOC
-    printf("[ALLOC] Found free space with objectsize %d in bucket %d at %p.\n", availableObjectSize, i, object);
-#endif
+    size_t availableObjectSize = realSize(objectHeader->tailingObjectSize);
 
     if (availableObjectSize == size + sizeof(header)) {
         // The remaining free space would not fit an actual object, just its header.
         // These 8 bytes are wasted, but 0 size objects are not possible currently (size 0 <=> end/start of block)
-
-#ifdef DEBUG_ALLOC
-        printf("[ALLOC] Allocating 8 byte more.\n");
-#endif
         size += sizeof(header);
     }
 
-    // Remove that free space from the corresponding list
-    removeFreeSpaceFromList(object);
-
-#ifdef DEBUG_ALLOC
-    printf("[ALLOC] Removed space from free list. bucket[%d]=%p\n", i, buckets[i]);
-#endif
-
     // Set header + footer of new object
-    objectHeader->tailingObjectSize = (uint32_t) size;
+    uint32_t poolBits = (uint32_t) pool << POOL_SHIFT;
+    objectHeader->tailingObjectSize = (uint32_t) size | poolBits;
     objectFooter = footerOf(object);
     objectFooter->precedingObjectSize = (uint32_t) size;
+    allocStats->liveBytes += size;
+    TRACE(ALLOC, object, size, pool, bucketIndex((uint32_t) size));
 
-    if (availableObjectSize > size) {
-        // Space for another object is remaining
-
-        void *remainingFreeObjectPtr = object + size + sizeof(header);
-        uint32_t remainingObjectSpace = (uint32_t) (availableObjectSize - size - sizeof(header));
-
-#ifdef DEBUG_ALLOC
-        printf("[ALLOC] There are %d bytes of object space left at %p.\n", remainingObjectSpace,
-               remainingFreeObjectPtr);
-#endif
-        header *freeObjectHeader = objectFooter;
-        freeObjectHeader->tailingObjectSize = remainingObjectSpace | 1;
-        header *freeObjectFooter = footerOf(remainingFreeObjectPtr);
-        freeObjectFooter->precedingObjectSize = remainingObjectSpace | 1;
-
-#ifdef DEBUG_ALLOC
-        printf("[ALLOC] Initialized free space (Header at %p, Footer at %p).\n", freeObjectHeader, freeObjectFooter);
-#endif
-
-        // Put that free space in the correct list (at the start)
-        int remainingSpaceIndex = (remainingObjectSpace / 8) - 1;
-        if (remainingSpaceIndex >= NUMBER_OF_BUCKETS) {
-            remainingSpaceIndex = NUMBER_OF_BUCKETS - 1;
-        }
-
-        // Has no previous free space
-        setFirst(remainingFreeObjectPtr, 0);
-        // Following free space is whatever is currently at the start
-        setSecond(remainingFreeObjectPtr, buckets[remainingSpaceIndex]);
-
-        // If the list wasn't empty before, point it to the new start
-        if (buckets[remainingSpaceIndex]) {
-            setFirst(buckets[remainingSpaceIndex], remainingFreeObjectPtr);
-        }
+    if (availableObjectSize == size) {
+        return 0;
+    }
 
-        // Start of list is this free space
-        buckets[remainingSpaceIndex] = remainingFreeObjectPtr;
+    // Space for another object is remaining
+    void *remainingFreeObjectPtr = object + size + sizeof(header);
+    uint32_t remainingObjectSpace = (uint32_t) (availableObjectSize - size - sizeof(header));
 
-#ifdef DEBUG_ALLOC
-        printf("[ALLOC] Free space (%p) has been put into bucket %d.\n", remainingFreeObjectPtr, remainingSpaceIndex);
-#endif
+    header *freeObjectHeader = objectFooter;
+    freeObjectHeader->tailingObjectSize = remainingObjectSpace | poolBits | 1;
+    header *freeObjectFooter = footerOf(remainingFreeObjectPtr);
+    freeObjectFooter->precedingObjectSize = remainingObjectSpace | 1;
+    TRACE(SPLIT, remainingFreeObjectPtr, remainingObjectSpace, pool, 0);
+    return remainingFreeObjectPtr;
+}
 
-#ifdef DEBUG_ALLOC
-        printf("[ALLOC] Inserting free space (%d bytes) in list (bucket %d)\n", remainingObjectSpace,
-               remainingSpaceIndex);
-#endif
+void *allocateObject(size_t size, int pool) {
+    if (size < 8) {
+        // Free spaces need room for the list links
+        size = 8;
+    }
+    if (size > PAGE_SPACE) {
+        // Does not fit into a page
+        return 0;
+    }
+    if (placement == MY_PLACEMENT_LOCAL && pool != MOVABLE_POOL && heapLists == &defaultLists) {
+        return allocateLocal(size, pool);
     }
 
-#ifdef DEBUG_ALLOC
-    printf("[ALLOC] Allocated address %p for size %d\n", object, headerOf(object)->tailingObjectSize);
-#endif
-
+    // Use the first free space large enough to fit the required size.
+    // Insert remaining space in corresponding list (bucket)
+    void *object = findFreeSpace(size, pool);
+    if (object == 0) {
+        return 0;
+    }
+    removeFreeSpaceFromList(object);
+    void *rest = splitFreeSpace(object, size, pool);
+    if (rest) {
+        insertFreeSpace(rest);
+    }
     return object;
 }
 
-void my_free(void *ptr) {
+void freeObject(void *ptr) {
 
     // Size of object to be deleted
-    int objectSize = headerOf(ptr)->tailingObjectSize;
+    int objectSize = realSize(headerOf(ptr)->tailingObjectSize);
+    allocStats->liveBytes -= objectSize;
+    // The resulting free space stays in the object's pool
+    uint32_t poolBits = headerOf(ptr)->tailingObjectSize & POOL_BITS;
+
+    int pool = poolBits >> POOL_SHIFT;
 
     // Size of resulting free space
     int totalFreeSize = objectSize;
-
-#ifdef DEBUG_FREE
-    printf("[FREE] Free called for %p (object size %d)\n", ptr, objectSize);
-#endif
-
-#ifdef DEBUG_USED
-    sumUsed -= objectSize;
-    printUsed();
-#endif
+    TRACE(FREE, ptr, objectSize, pool, bucketIndex(objectSize));
+    // Sides merged with the object
+    int merged = 0;
+    // Whether a neighbour is the active space of the pool, which is in no list. The merged space replaces it.
+    int active = 0;
 
     // Combine tailing free space
     if (footerOf(ptr)->tailingObjectSize & 1) {
         // Tailing object is also empty
-
-#ifdef DEBUG_FREE
-        printf("[FREE] There is free space (object size %d) behind object.\n",
-               realSize(footerOf(ptr)->tailingObjectSize));
-#endif
-
         int tailingObjectSize = realSize(footerOf(ptr)->tailingObjectSize);
         totalFreeSize = objectSize + sizeof(header) + tailingObjectSize;
 
         void *tailingObject = ptr + objectSize + sizeof(header);
-
-#ifdef DEBUG_FREE
-        printf("[FREE] Concatenating free space behind (object %p).\n", tailingObject);
-#endif
-
-#ifdef DEBUG_FREE
-        printf("[FREE] Removing object from list.\n");
-#endif
-        removeFreeSpaceFromList(tailingObject);
+        if (tailingObject == activeSpaces[pool]) {
+            active = 1;
+        } else {
+            removeFreeSpaceFromList(tailingObject);
+        }
+        merged |= 1;
     }
 
     // Combine preceding free space
@@ -372,40 +563,166 @@ void my_free(void *ptr) {
         int precedingObjectSize = realSize(headerOf(ptr)->precedingObjectSize);
         totalFreeSize += precedingObjectSize + sizeof(header);
 
-#ifdef DEBUG_FREE
-        printf("[FREE] There is free space (object size %d) before object.\n",
-               precedingObjectSize);
-#endif
-
         void *precedingObject = ptr - precedingObjectSize - sizeof(header);
-        removeFreeSpaceFromList(precedingObject);
+        if (precedingObject == activeSpaces[pool]) {
+            active = 1;
+        } else {
+            removeFreeSpaceFromList(precedingObject);
+        }
         ptr = precedingObject;
+        merged |= 2;
     }
 
     // expand free object
-    headerOf(ptr)->tailingObjectSize = (uint32_t) totalFreeSize | 1;
+    headerOf(ptr)->tailingObjectSize = (uint32_t) totalFreeSize | poolBits | 1;
     footerOf(ptr)->precedingObjectSize = (uint32_t) totalFreeSize | 1;
+    if (merged) {
+        TRACE(COALESCE, ptr, totalFreeSize, pool, merged);
+    }
 
-    // Insert
-    int index = (totalFreeSize / 8) - 1;
-    if (index >= NUMBER_OF_BUCKETS) {
-        index = NUMBER_OF_BUCKETS - 1;
+    if (active) {
+        activeSpaces[pool] = ptr;
+    } else {
+        // Insert, a page that is empty now goes to emptyPages
+        insertFreeSpace(ptr);
     }
+}
 
-#ifdef DEBUG_FREE
-    printf("[FREE] Inserting free space (%d bytes) in list (bucket %d)\n", totalFreeSize, index);
-#endif
 
-    setSecond(ptr, buckets[index]);
-    setFirst(ptr, 0);
+// Counts an allocation through the public functions
+static void *counted(void *object) {
+    if (object) {
+        allocStats->allocations++;
+    } else {
+        allocStats->failedAllocations++;
+    }
+    return object;
+}
 
-    if (buckets[index] != 0) {
-        setFirst(buckets[index], ptr);
+// Parenthesized to keep the inline fast path macro from my_alloc.h out of the definition.
+void *(my_alloc)(size_t size) {
+    lockAlloc();
+    void *object = 0;
+    if ((bytesUntilSample -= size) < 0) {
+        object = sampleObject(size, 0);
+    } else if (size <= BITMAP_MAX_SIZE && bitmapPages) {
+        object = bitmapAlloc(size);
+    } else if (size > PAGE_SPACE && spans) {
+        object = spanAlloc(size);
+    }
+    if (!object) {
+        object = allocateObject(size, 0);
     }
+    counted(object);
+    unlockAlloc();
+    return object;
+}
 
-    buckets[index] = ptr;
+void *my_alloc_hint(size_t size, int hint) {
+    // Pool 0 is the default pool, the others are indexed by the hint
+    int pool = hint == MY_SHORT_LIVED || hint == MY_LONG_LIVED ? hint : 0;
+    if (pool == 0 || size > PAGE_SPACE) {
+        // Spans have no pools
+        return (my_alloc)(size);
+    }
+    lockAlloc();
+    void *object = (bytesUntilSample -= size) < 0 ? sampleObject(size, pool) : allocateObject(size, pool);
+    counted(object);
+    unlockAlloc();
+    return object;
+}
 
-#ifdef DEBUG_FREE
-    printf("[FREE] Done.\n");
-#endif
+void freeAnyObject(void *ptr) {
+    allocStats->frees++;
+    if (isSpanObject(ptr)) {
+        if (spanSampled(ptr)) {
+            forgetSample(ptr);
+        }
+        spanFree(ptr);
+    } else if (isBitmapObject(ptr)) {
+        bitmapFree(ptr);
+    } else {
+        if (footerOf(ptr)->precedingObjectSize & SAMPLED) {
+            forgetSample(ptr);
+        }
+        freeObject(ptr);
+    }
+}
+
+void my_free(void *ptr) {
+    lockAlloc();
+    freeAnyObject(ptr);
+    unlockAlloc();
+}
+
+// Arena: Blocks are chained through their first 8 bytes, the arena itself lives behind the link in its first block.
+struct my_arena {
+    char *top;  // Next free byte in the current block
+    char *end;  // End of the current block
+    void *blocks;  // Most recent block
+};
+
+// Links a new block into the arena and makes it the current one
+static void arenaAddBlock(my_arena *arena, void *block) {
+    *(void **) block = arena->blocks;
+    arena->blocks = block;
+    arena->top = block + sizeof(void *);
+    arena->end = block + BLOCKSIZE;
+}
+
+// Reuses an empty page if there is one, new block otherwise
+static void *arenaBlock() {
+    void *block;
+    lockAlloc();
+    doublePointer *space = heapLists->emptyPages;
+    if (space) {
+        removeFreeSpaceFromList(space);
+        block = (void *) space - sizeof(header);
+    } else {
+        block = newBlock();
+    }
+    unlockAlloc();
+    return block;
+}
+
+my_arena *my_arena_create() {
+    void *block = arenaBlock();
+    if (!block) {
+        return 0;
+    }
+    my_arena *arena = block + sizeof(void *);
+    arena->blocks = 0;
+    arenaAddBlock(arena, block);
+    arena->top += sizeof(my_arena);
+    return arena;
+}
+
+void *my_arena_alloc(my_arena *arena, size_t size) {
+    size = (size + 7) & ~(size_t) 7;
+    if (size > (size_t) (arena->end - arena->top)) {
+        if (size > BLOCKSIZE - sizeof(void *)) {
+            return 0;
+        }
+        void *block = arenaBlock();
+        if (!block) {
+            return 0;
+        }
+        arenaAddBlock(arena, block);
+    }
+    void *object = arena->top;
+    arena->top += size;
+    return object;
+}
+
+void my_arena_destroy(my_arena *arena) {
+    // The arena is stored in its first (last in the chain) block, so take it apart before formatting the pages
+    void *block = arena->blocks;
+    lockAlloc();
+    while (block) {
+        void *next = *(void **) block;
+        formatPage(block);
+        insertFreeSpace(block + sizeof(header));
+        block = next;
+    }
+    unlockAlloc();
 }
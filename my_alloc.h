@@ -1,6 +1,7 @@
 #ifndef MY_ALLOC_H
 #define MY_ALLOC_H
 
+#include <stdint.h>
 #include <stdlib.h>
 
 /* This function is called exactly once before the first call to
@@ -10,6 +11,8 @@ void init_my_alloc();
 
 /* Return a pointer to size bytes of memory. Size will be a multiple of
  * 8 Bytes. The return value must be aligned to 8 bytes.
+ * Objects larger than a page up to 1 MiB are placed in spans of whole
+ * blocks. Returns 0 if size exceeds 1 MiB or memory is exhausted.
  */
 void* my_alloc(size_t size);
 
@@ -19,4 +22,332 @@ void* my_alloc(size_t size);
  */
 void my_free(void * ptr);
 
+/* Like my_alloc, with a hint how long the object will live. Objects
+ * with different hints are placed on different pages, so pages of
+ * short-lived objects empty out quickly and can be reused for anything.
+ * A hint of 0 is the same as my_alloc.
+ */
+#define MY_SHORT_LIVED 1
+#define MY_LONG_LIVED 2
+
+void* my_alloc_hint(size_t size, int hint);
+
+/* Handles for objects the allocator may move to compact the heap. The
+ * address of an object is only stable while it is pinned: my_hpin
+ * returns it, and it may change after the matching my_hunpin. Pins
+ * nest. my_halloc returns 0 if memory is exhausted.
+ */
+typedef uint32_t my_handle;
+
+my_handle my_halloc(size_t size);
+void* my_hpin(my_handle h);
+void my_hunpin(my_handle h);
+void my_hfree(my_handle h);
+
+/* Incremental compaction: move the unpinned objects off up to pages of
+ * the sparsest pages holding handle objects, into free space of the
+ * others. Returns the number of pages emptied, which are reused for any
+ * allocation. my_alloc also compacts when it would exceed the budget.
+ */
+size_t my_hcompact(size_t pages);
+
+/* Sampling heap profiler. After my_alloc_profile_start, about one
+ * allocation per rate bytes (0 selects 512 KiB) is sampled: its call
+ * stack is kept until the object is freed. my_alloc_profile_dump
+ * writes the sampled live objects to path as a heap profile pprof
+ * reads. If signalPath is not 0, SIGUSR2 asks for a dump to it, which
+ * the next allocation writes. Both return 0 on success, -1 with errno
+ * set otherwise. my_alloc_profile_stop stops sampling, objects sampled
+ * before stay in the profile until they are freed.
+ */
+int my_alloc_profile_start(size_t rate, const char * signalPath);
+void my_alloc_profile_stop();
+int my_alloc_profile_dump(const char * path);
+
+/* Limit the memory my_alloc takes from the system to bytes (rounded
+ * down to whole blocks). 0 removes the limit, which is the default.
+ * Once the limit is reached, my_alloc returns 0 instead of a pointer.
+ * Pages that empty out stay counted and are reused. When an object
+ * larger than a page needs new blocks, they are given back to make
+ * room for it. my_alloc_trim releases their memory.
+ */
+void my_alloc_set_budget(size_t bytes);
+
+/* Register a function that is called when an allocation of size bytes
+ * can't be served within the budget, after the allocator has reclaimed
+ * what it can itself. It may free memory with my_free and should return
+ * nonzero if it did, the allocation is retried then. If it returns 0,
+ * my_alloc returns 0.
+ */
+void my_alloc_set_pressure_callback(int (*callback)(size_t size));
+
+/* Give the memory of the empty pages of my_alloc back to the system.
+ * The pages stay with the allocator and are faulted in again when they
+ * are reused, only the first system page of each is kept. Returns the
+ * number of bytes released.
+ */
+size_t my_alloc_trim();
+
+/* Choose how objects are placed. MY_PLACEMENT_BUCKETS, the default,
+ * takes the most recently freed space of a fitting size from anywhere
+ * in the heap. MY_PLACEMENT_LOCAL carves objects one after another from
+ * an active free space. When it is used up, the next one comes from the
+ * same page if the page has room left, so objects allocated together
+ * end up close to each other. Objects behind handles are always placed
+ * by buckets. Locality costs memory and time: in testit -l 1 50000 the
+ * local mode takes 4063 blocks against 3527 and builds the list about
+ * twice as slowly (1768 against 849 ns per node), as it walks pages and
+ * leaves the rest of a page's spaces behind when it moves on.
+ */
+#define MY_PLACEMENT_BUCKETS 0
+#define MY_PLACEMENT_LOCAL 1
+void my_alloc_set_placement(int mode);
+
+/* Make my_alloc, my_free and the arena functions safe to call from
+ * several threads at once by serializing them on a spinlock. Must be
+ * called before the threads start.
+ */
+void my_alloc_threadsafe(int enable);
+
+/* Epoch-based reclamation for lock-free data structures. A thread
+ * reads shared objects between my_epoch_enter and my_epoch_exit, which
+ * may nest. An object unlinked from such a structure goes to
+ * my_free_deferred instead of my_free: it is freed once every thread
+ * that was in a read section at that time has left it. The calling
+ * thread must be done with the object. Deferred objects are freed in
+ * batches, from my_free_deferred and when memory runs short.
+ * my_epoch_reclaim frees all that no reader holds back and returns the
+ * number of objects still waiting. Only for objects of my_alloc and
+ * my_alloc_hint, and with several threads only after
+ * my_alloc_threadsafe. my_epoch_enter returns 0, or -1 if there is no
+ * memory to register the thread.
+ */
+int my_epoch_enter();
+void my_epoch_exit();
+void my_free_deferred(void * ptr);
+size_t my_epoch_reclaim();
+
+/* Arena for objects that die together: my_arena_alloc is a pointer
+ * increment inside whole blocks and stores no per-object header.
+ * Objects can't be freed individually, my_arena_destroy hands all of
+ * the arena's pages to my_alloc at once. my_arena_alloc returns 0 if
+ * size doesn't fit into a single block.
+ */
+typedef struct my_arena my_arena;
+
+my_arena* my_arena_create();
+void* my_arena_alloc(my_arena * arena, size_t size);
+void my_arena_destroy(my_arena * arena);
+
+/* Heaps of their own, e.g. one per subsystem or tenant, so that their
+ * fragmentation does not mix. A heap keeps the pages it took, also
+ * after its objects are freed, until my_heap_destroy frees all of its
+ * objects at once and hands the pages to my_alloc. Objects of a heap
+ * must be freed with my_heap_free on the same heap, never with my_free.
+ * my_heap_alloc places objects by buckets, without sampling, and
+ * returns 0 if size doesn't fit into a page or memory is exhausted.
+ * Pages of heaps in a persistent heap file are lost on restart.
+ */
+typedef struct my_heap my_heap;
+
+my_heap* my_heap_create();
+void* my_heap_alloc(my_heap * heap, size_t size);
+void my_heap_free(my_heap * heap, void * ptr);
+void my_heap_destroy(my_heap * heap);
+
+/* Heap shared between processes, for passing objects without copying
+ * them. my_heap_shared_create makes one of size bytes (rounded down to
+ * whole blocks, at most 4 GiB) in a memfd. The memory is only used as
+ * pages are taken. my_heap_shared_fd returns the descriptor. Children
+ * forked afterwards already have the heap. Other processes get the
+ * descriptor, e.g. over a Unix socket, and pass it to
+ * my_heap_shared_attach, which takes it over. Every process maps the
+ * heap at the same address, and a process can have one shared heap at
+ * a time. Use my_heap_alloc and my_heap_free on it from any of them.
+ * An object may be freed by a process that did not allocate it. The
+ * heap never grows and its pages are not reused by my_alloc.
+ * my_heap_destroy only unmaps the heap in the calling process and
+ * closes its descriptor. The memory goes away once no process has it
+ * mapped. create and attach return 0 with errno set on failure.
+ * If a process dies inside my_heap_alloc or my_heap_free, the next
+ * call in any process checks the pages and builds the lists anew. If
+ * they are broken, my_heap_alloc returns 0 with errno ENOTRECOVERABLE
+ * and my_heap_free does nothing from then on, in all processes.
+ * my_heap_offset turns an object into an offset that my_heap_pointer
+ * turns back into the object in every process that has the heap.
+ */
+my_heap* my_heap_shared_create(size_t size);
+my_heap* my_heap_shared_attach(int fd);
+int my_heap_shared_fd(my_heap * heap);
+size_t my_heap_offset(my_heap * heap, void * ptr);
+void* my_heap_pointer(my_heap * heap, size_t offset);
+
+/* Persistent heap: Take all pages from the file at path, mapped at a
+ * fixed address, instead of get_block_from_system. If the file already
+ * holds a heap, allocation resumes where the last process left off. If
+ * that process did not sync (it crashed or left with _exit), the free
+ * lists are rebuilt from the pages, which reads the whole file. Objects
+ * larger than a page are not supported, my_alloc returns 0 for them,
+ * and small objects take the space of ordinary pages: spans and bitmap
+ * pages are not kept in the file. Must be called before the first call
+ * to my_alloc. Returns 0 on success, -1 with errno set otherwise.
+ */
+int my_alloc_persistent(const char * path);
+
+/* Store the free lists in the heap file and flush it to disk. This is
+ * done automatically at exit. Returns 0 on success, -1 otherwise.
+ */
+int my_alloc_persistent_sync();
+
+/* A single pointer kept in the heap file, for the application to find
+ * its data again after a restart.
+ */
+void* my_alloc_persistent_root();
+void my_alloc_persistent_set_root(void * root);
+
+/* Publish the allocator's counters (struct my_alloc_stats below) in the
+ * POSIX shared memory object name, e.g. "/myalloc.1234", so that other
+ * processes (see mystat) can watch them while this one runs. The object
+ * stays after exit until it is unlinked. Returns 0 on success, -1 with
+ * errno set otherwise.
+ */
+int my_alloc_stats_export(const char * name);
+
+/* Record what the allocator does internally (allocations and frees,
+ * free list inserts and removals, splits, coalescing, new pages and
+ * bucket misses) as binary records with a TSC timestamp. They go to a
+ * ring buffer mapped from the file at path that holds the last records
+ * of them (rounded up to a power of two, 0 for 1M). mytrace decodes it,
+ * also while the process runs or after it crashed. Compiled out with
+ * MY_ALLOC_NO_TRACE. Returns 0 on success, -1 with errno set otherwise.
+ */
+int my_alloc_trace_start(const char * path, size_t records);
+
+/* Stop recording and close the trace file. */
+void my_alloc_trace_stop();
+
+/* Internal data structures, as far as the inline fast path below reads
+ * them, and the counters of my_alloc_stats_export. Everything else is
+ * in my_alloc_internal.h, the trace file format in my_alloc_trace.h.
+ */
+
+// Size classes of the free lists: NUMBER_OF_LISTS, sizeClassStart and sizeClassOf.
+// Generated by mysizes, MY_SIZE_CLASSES may name another table than the default one.
+#ifdef MY_SIZE_CLASSES
+#include MY_SIZE_CLASSES
+#else
+#include "my_size_classes.h"
+#endif
+// Default pool, one for each lifetime hint and one for objects behind handles
+#define NUMBER_OF_POOLS 4
+
+// Doublepointer: To fit a doubly linked list in 8 byte objects we only store the lower 32bit of each pointer.
+typedef void *doublePointer;
+
+// LSB == 1: space not occupied
+typedef struct header {
+    uint32_t tailingObjectSize;  // Footer of preceding object
+    uint32_t precedingObjectSize;  // Header of following object
+} header;
+
+// Start of the 4 GiB window all blocks lie in, free list links are 32 bit offsets against it
+extern uintptr_t pointerBase;
+
+// The free lists of a heap
+struct freeLists {
+    // Bucket n contains first element of linked list of free spaces of the sizes of class n in my_size_classes.h.
+    // Every pool has its own buckets, bit n of nonEmptyBuckets[pool] is set if bucket n is not empty.
+    doublePointer *buckets[NUMBER_OF_POOLS][NUMBER_OF_LISTS];
+    uint64_t nonEmptyBuckets[NUMBER_OF_POOLS];
+    // Free spaces that cover a whole page. These don't belong to any pool.
+    doublePointer *emptyPages;
+};
+
+// Lists of my_alloc
+extern struct freeLists defaultLists;
+
+// Set by my_alloc_threadsafe
+extern int threadSafe;
+
+// Set by my_alloc_set_placement
+extern int placement;
+
+// Allocated bytes until the heap profiler samples the next allocation
+extern int64_t bytesUntilSample;
+
+// Trace header while my_alloc_trace_start is in effect, 0 otherwise. The format is in my_alloc_trace.h.
+struct my_alloc_trace_header;
+extern struct my_alloc_trace_header *traceHeader;
+
+#define MY_ALLOC_STATS_MAGIC 0x3353544154534d41  // "AMSTATS3"
+
+// Counters, kept in a static struct until my_alloc_stats_export moves them to shared memory.
+// Only allocating threads write them, under the allocator lock if there is one. Each counter is an aligned 64 bit
+// word, so readers always see a whole value, but not a snapshot of all of them at the same instant.
+struct my_alloc_stats {
+    uint64_t magic;
+    uint32_t blockSize;
+    uint32_t pools;
+    uint32_t lists;
+    int32_t pid;
+    uint64_t systemBlocks;  // get_sys_blockcount()
+    uint64_t blocksTaken;  // From blockSource, counted against the budget
+    uint64_t newPages;  // initNewPage and other slow paths that took a new block
+    uint64_t liveBytes;  // In objects, without headers
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t failedAllocations;
+    uint64_t bitmapPages;
+    int64_t emptyPages;
+    int64_t freeSpaces[NUMBER_OF_POOLS][NUMBER_OF_LISTS];  // Per bucket
+    uint64_t spanBlocks;  // In runs for spans, included in blocksTaken
+    uint64_t freeSpanBlocks;  // In free spans
+    uint64_t deferredObjects;  // Waiting in my_free_deferred for readers
+};
+
+extern struct my_alloc_stats *allocStats;
+
+/* Compile-time size class fast path: if the size of a my_alloc call is a
+ * constant, the bucket index folds away and an exact fit is popped from
+ * its bucket without a function call. Everything else (empty bucket,
+ * sizes without a bucket of their own, thread safe mode, allocations the
+ * heap profiler samples, tracing, local placement) goes through the
+ * regular my_alloc.
+ * Define MY_ALLOC_NO_INLINE to disable.
+ */
+#if defined(__GNUC__) && !defined(MY_ALLOC_NO_INLINE)
+
+static inline void *my_alloc_constant(size_t size) {
+    int i = size >= 8 && size <= SIZE_CLASS_LIMIT ? sizeClassOf[(size >> 3) - 1] : 0;
+    if (threadSafe || size < 8 || size > SIZE_CLASS_LIMIT || !(EXACT_LISTS >> i & 1) ||
+        defaultLists.buckets[0][i] == 0 || bytesUntilSample < (int64_t) size || traceHeader || placement) {
+        return (my_alloc)(size);
+    }
+    bytesUntilSample -= size;
+
+    // Every space in bucket i of the default pool has exactly the requested size: unlink the head.
+    doublePointer *object = defaultLists.buckets[0][i];
+    uintptr_t following = (uintptr_t) *object & 0x00000000ffffffff;
+    if (following & 1) {
+        defaultLists.buckets[0][i] = 0;
+        defaultLists.nonEmptyBuckets[0] &= ~((uint64_t) 1 << i);
+    } else {
+        doublePointer *next = (doublePointer *) (following + pointerBase);
+        *next = (doublePointer) (((uintptr_t) *next & 0x00000000ffffffff) | ((uintptr_t) 1 << 32));
+        defaultLists.buckets[0][i] = next;
+    }
+
+    allocStats->freeSpaces[0][i]--;
+    allocStats->liveBytes += size;
+    allocStats->allocations++;
+
+    ((header *) object - 1)->tailingObjectSize = (uint32_t) size;
+    ((header *) ((char *) object + size))->precedingObjectSize = (uint32_t) size;
+    return object;
+}
+
+#define my_alloc(size) (__builtin_constant_p(size) ? my_alloc_constant(size) : (my_alloc)(size))
+
+#endif
+
 #endif
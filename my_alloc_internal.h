@@ -0,0 +1,203 @@
+#ifndef MY_ALLOC_INTERNAL_H
+#define MY_ALLOC_INTERNAL_H
+
+// Functions and definitions of my_alloc.c shared with the other parts of the allocator.
+
+#include <stdint.h>
+
+#include "my_alloc.h"
+#include "my_alloc_trace.h"
+#include "my_system.h"
+
+typedef void page;
+
+// Lists the allocator works on: defaultLists, or those of a my_heap during a call to it
+extern struct freeLists *heapLists;
+
+// Where new pages come from, get_block_from_system by default
+extern void *(*blockSource)();
+
+// Header of 0: end of page
+#define END_OF_PAGE 0
+// Footer of 0: start of page
+#define START_OF_PAGE 0
+
+// Bits 1 and 2 of tailingObjectSize (header of an object) store the pool the object belongs to.
+#define POOL_SHIFT 1
+#define POOL_BITS 6
+
+// Bit 1 of precedingObjectSize (footer of an object) is set if the heap profiler sampled the object
+#define SAMPLED 2
+
+// Pool of objects behind handles, which may be moved
+#define MOVABLE_POOL 3
+
+// Object size of the free space spanning a whole page
+#define PAGE_SPACE (BLOCKSIZE - 2 * sizeof(header))
+
+// A block covers whole frames of the frame map, and the default size classes fit into nonEmptyBuckets
+_Static_assert(BLOCKSIZE >= 4096 && BLOCKSIZE <= 65536 && (BLOCKSIZE & (BLOCKSIZE - 1)) == 0,
+               "BLOCKSIZE must be a power of two from 4096 to 65536");
+_Static_assert(SIZE_CLASS_LIMIT == PAGE_SPACE, "my_size_classes.h was generated for another BLOCKSIZE");
+_Static_assert(NUMBER_OF_LISTS <= 64, "nonEmptyBuckets has a bit per list");
+
+// Size of the window of pointerBase
+#define LINK_WINDOW ((uintptr_t) 1 << 32)
+
+// Whether size bytes from start lie in the window of pointerBase, which is placed around the first memory asked for
+int inLinkWindow(void *start, size_t size);
+
+// Frame map: one entry per 4 KiB frame of the window of pointerBase.
+// Blocks are page aligned, so each block covers BLOCKSIZE >> FRAME_SHIFT whole frames.
+// An entry is 0 for ordinary pages. For pages of MOVABLE_POOL it holds their page table index.
+// For bitmap pages it is FRAME_BITMAP plus the number of the frame within the block, for spans FRAME_SPAN.
+#define FRAME_SHIFT 12
+#define FRAMES_PER_BLOCK (BLOCKSIZE >> FRAME_SHIFT)
+#define FRAME_BITMAP 0x80000000
+#define FRAME_SPAN 0x40000000
+
+extern uint32_t frames[1 << (32 - FRAME_SHIFT)];
+
+static inline uint32_t *frameOf(void *p) {
+    return &frames[(uint32_t) ((uintptr_t) p - pointerBase) >> FRAME_SHIFT];
+}
+
+// Set while the compactor moves objects: allocations must not take new or empty pages
+extern int noNewPages;
+
+// Limit of my_alloc_set_budget and the blocks counted against it, including those of spans
+extern size_t budget;
+extern size_t blocksTaken;
+
+void lockAlloc();
+void unlockAlloc();
+// Takes a spinlock that is released by storing 0, with backoff
+void spinLock(int *lock);
+
+header *headerOf(void *object);
+header *footerOf(void *object);
+uint32_t realSize(uint32_t s);
+uint32_t poolOf(uint32_t s);
+int bucketIndex(uint32_t size);
+
+void *secondPointer(doublePointer d);
+void removeFreeSpaceFromList(doublePointer *p);
+void insertFreeSpace(void *ptr);
+
+void *newBlock();
+void formatPage(page *p);
+// After an allocation of size failed within the budget: reclaims memory, then asks the pressure callback.
+// Returns whether the allocation is worth trying again.
+int makeRoom(size_t size);
+// Gives up to count empty pages back against the budget, newBlock reuses them. Returns the number of pages.
+size_t releaseEmptyPages(size_t count);
+
+void *findFreeSpace(size_t size, int pool);
+void *splitFreeSpace(void *object, size_t size, int pool);
+void *allocateObject(size_t size, int pool);
+void freeObject(void *ptr);
+// my_free without the lock, for objects on pages, bitmap pages and in spans
+void freeAnyObject(void *ptr);
+
+// my_placement.c
+// Free space each pool carves objects from in MY_PLACEMENT_LOCAL mode. It is in no list.
+extern void *activeSpaces[NUMBER_OF_POOLS];
+
+void *allocateLocal(size_t size, int pool);
+// Puts the active spaces back into the lists
+void retireActiveSpaces();
+
+// my_heap.c
+struct directory;
+struct sharedHeap;
+
+struct my_heap {
+    struct freeLists lists;
+    struct directory *directory;  // Most recent list of blocks of the heap
+    struct sharedHeap *shared;  // Region of a shared heap, whose pages are not listed, 0 otherwise
+};
+
+// Block for the my_heap whose lists are heapLists, formatted as an empty page that is in no list. 0 if out of memory.
+void *heapPage();
+
+// my_shared.c
+// Take and release the lock of a shared heap, make the allocator use its pointerBase and counters in between.
+// enterShared returns -1 with errno set if the heap can't be used, after a process died leaving its pages broken.
+int enterShared(struct sharedHeap *s);
+void leaveShared(struct sharedHeap *s);
+// Next page of the region, formatted like heapPage. 0 if the region is used up.
+void *sharedPage(struct sharedHeap *s);
+// Unmaps the region in this process
+void detachShared(struct sharedHeap *s);
+
+// my_handle.c
+void registerMovablePage(page *p);
+void unregisterMovablePage(page *p);
+size_t compact(size_t pages);
+
+// my_bitmap.c
+// Objects up to this size go to bitmap pages unless bitmapPages is 0
+#define BITMAP_MAX_SIZE 64
+
+extern int bitmapPages;
+
+void *bitmapAlloc(size_t size);
+void bitmapFree(void *ptr);
+
+static inline int isBitmapObject(void *ptr) {
+    return (*frameOf(ptr) & FRAME_BITMAP) != 0;
+}
+
+// my_span.c
+// Objects larger than PAGE_SPACE up to this size are carved from multi-block spans unless spans is 0
+#define SPAN_MAX_SIZE ((size_t) 1 << 20)
+
+extern int spans;
+
+void *spanAlloc(size_t size);
+void spanFree(void *ptr);
+void spanMarkSampled(void *ptr);
+int spanSampled(void *ptr);
+// Turns the blocks of runs without any span in use into empty pages. Returns the number of blocks.
+size_t releaseSpanRuns();
+
+static inline int isSpanObject(void *ptr) {
+    return (*frameOf(ptr) & FRAME_SPAN) != 0;
+}
+
+// my_epoch.c
+// Frees the deferred objects that no reader can see anymore, as far as the readers let the epoch move.
+// Returns whether any were freed.
+int reclaimDeferred();
+
+// my_persist.c
+// Notes in the heap file, if there is one, that objects carry SAMPLED bits. The next process that opens it clears them.
+void persistentSampled();
+// Gives the memory of size bytes from start back to the system, they read back as zeros. Returns 0 on success.
+int releaseMemory(void *start, size_t size);
+
+// my_stats.c
+// Recounts the free spaces in all lists, for lists that did not come about through insertFreeSpace
+void countFreeSpaces();
+
+// my_trace.c
+// Appends a record, callers hold the allocator lock.
+// Out of line, so the trace points take no room in the allocator's paths while tracing is off.
+__attribute__((cold)) void traceEvent(int event, void *address, size_t size, int pool, int bucket);
+
+#ifdef MY_ALLOC_NO_TRACE
+#define TRACE(event, address, size, pool, bucket) ((void) 0)
+#else
+#define TRACE(event, address, size, pool, bucket) \
+    do { \
+        if (__builtin_expect(traceHeader != 0, 0)) { \
+            traceEvent(MY_TRACE_##event, address, size, pool, bucket); \
+        } \
+    } while (0)
+#endif
+
+// my_profile.c
+void *sampleObject(size_t size, int pool);
+void forgetSample(void *object);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef MY_ALLOC_TRACE_H
+#define MY_ALLOC_TRACE_H
+
+/* Format of the trace file my_alloc_trace_start writes, for mytrace. */
+
+#include "my_alloc.h"
+
+#define MY_ALLOC_TRACE_MAGIC 0x3145434152544d41  // "AMTRACE1"
+
+// Start of the trace file, followed by capacity records
+struct my_alloc_trace_header {
+    uint64_t magic;
+    uint32_t recordSize;
+    uint32_t capacity;  // A power of two
+    uint64_t written;  // Records so far, record n is at index n % capacity
+    // Clocks when tracing started and stopped, to convert timestamps to ns. Stop is 0 while tracing.
+    uint64_t startTsc;
+    uint64_t startNs;  // CLOCK_MONOTONIC
+    uint64_t stopTsc;
+    uint64_t stopNs;
+    int32_t pid;
+    uint32_t tscIsNs;  // No TSC on this machine, timestamps are CLOCK_MONOTONIC ns
+};
+
+#define MY_TRACE_ALLOC 1
+#define MY_TRACE_FREE 2
+#define MY_TRACE_SPLIT 3  // Remainder of a free space that was split
+#define MY_TRACE_COALESCE 4  // Free space after merging, bucket holds the merged sides (1 following, 2 preceding)
+#define MY_TRACE_INSERT 5  // Into a free list, bucket NUMBER_OF_LISTS is emptyPages
+#define MY_TRACE_REMOVE 6
+#define MY_TRACE_NEW_PAGE 7  // Block from blockSource, or run of size bytes for spans
+#define MY_TRACE_BUCKET_MISS 8  // Requested bucket had no fitting space, address is the space used instead
+#define MY_TRACE_OUT_OF_MEMORY 9
+#define MY_TRACE_EVENTS 10
+
+// Objects that belong to no pool
+#define MY_TRACE_BITMAP NUMBER_OF_POOLS
+#define MY_TRACE_SPAN (NUMBER_OF_POOLS + 1)
+
+struct my_alloc_trace_record {
+    uint64_t tsc;
+    uint64_t address;  // Object or free space
+    uint32_t size;
+    uint8_t event;
+    uint8_t pool;  // Or MY_TRACE_BITMAP, MY_TRACE_SPAN
+    uint16_t bucket;  // Free list index, span bin
+};
+
+#endif
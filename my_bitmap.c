@@ -0,0 +1,268 @@
+// MY_ALLOC_NO_SIMD searches the bitmaps a word at a time, like on machines without vector instructions
+#ifndef MY_ALLOC_NO_SIMD
+#if defined(__AVX2__)
+#define BITMAP_AVX2
+#elif defined(__SSE2__)
+#define BITMAP_SSE2
+#endif
+#endif
+
+#if defined(BITMAP_AVX2) || defined(BITMAP_SSE2)
+#include <immintrin.h>
+#endif
+
+#include "my_alloc_internal.h"
+
+// Bitmap pages for tiny objects.
+// The block is divided into 8 byte granules. An object is a run of granules, the bitmaps store which granules are in
+// use and which one ends an object. Objects need no boundary tags, freeing clears their bits.
+// The frame map marks the frames of a bitmap page, so my_free can tell bitmap objects from tagged ones.
+
+#define GRANULE 8
+#define BITMAP_GRANULES (BLOCKSIZE / GRANULE)
+#define BITMAP_WORDS (BITMAP_GRANULES / 64)
+
+typedef struct bitmapPage {
+    uint64_t used[BITMAP_WORDS + 1];  // Granules in use, the last word is always full and ends run searches
+    uint64_t ends[BITMAP_WORDS];  // Last granule of each object
+    struct bitmapPage *next;  // Pages that may have a free run
+    struct bitmapPage *prev;
+    uint32_t freeGranules;
+    uint16_t linked;  // Whether the page is in partialPages
+    uint16_t firstWord;  // Words before this one are full
+} bitmapPage;
+
+// Granules taken by the page struct itself
+#define META_GRANULES ((sizeof(bitmapPage) + GRANULE - 1) / GRANULE)
+
+int bitmapPages = 1;
+
+// Pages with free granules, the one most recently freed into first.
+// A page leaves the list when a search on it fails and comes back on the next free.
+static bitmapPage *partialPages = 0;
+
+static void linkPage(bitmapPage *p) {
+    p->linked = 1;
+    p->prev = 0;
+    p->next = partialPages;
+    if (partialPages) {
+        partialPages->prev = p;
+    }
+    partialPages = p;
+}
+
+static void unlinkPage(bitmapPage *p) {
+    p->linked = 0;
+    if (p->prev) {
+        p->prev->next = p->next;
+    } else {
+        partialPages = p->next;
+    }
+    if (p->next) {
+        p->next->prev = p->prev;
+    }
+}
+
+static void setFrames(void *block, uint32_t kind) {
+    for (uint32_t i = 0; i < FRAMES_PER_BLOCK; ++i) {
+        *frameOf(block + (i << FRAME_SHIFT)) = kind ? kind | i : 0;
+    }
+}
+
+static bitmapPage *pageOf(void *object) {
+    uint32_t frame = *frameOf(object) & ~FRAME_BITMAP;
+    return (bitmapPage *) (((uintptr_t) object & ~(uintptr_t) ((1 << FRAME_SHIFT) - 1)) - (frame << FRAME_SHIFT));
+}
+
+// Turns an empty page or a new block into a bitmap page
+static bitmapPage *newBitmapPage() {
+    void *block;
+    if (heapLists->emptyPages) {
+        block = heapLists->emptyPages;
+        removeFreeSpaceFromList(block);
+        block -= sizeof(header);
+    } else {
+        block = newBlock();
+        if (!block) {
+            return 0;
+        }
+    }
+
+    bitmapPage *p = block;
+    for (int i = 0; i < BITMAP_WORDS; ++i) {
+        p->used[i] = 0;
+        p->ends[i] = 0;
+    }
+    p->used[BITMAP_WORDS] = ~(uint64_t) 0;
+    for (uint32_t g = 0; g < META_GRANULES; ++g) {
+        p->used[g / 64] |= (uint64_t) 1 << (g % 64);
+    }
+    p->freeGranules = BITMAP_GRANULES - META_GRANULES;
+    p->firstWord = META_GRANULES / 64;
+    setFrames(p, FRAME_BITMAP);
+    linkPage(p);
+    allocStats->bitmapPages++;
+    return p;
+}
+
+// Bit j of the result is set where granules j .. j + run - 1 of word w are free
+static inline uint64_t runsInWord(bitmapPage *p, int w, int run) {
+    uint64_t m = ~p->used[w];
+    uint64_t next = ~p->used[w + 1];
+    for (int len = 1; len < run;) {
+        int shift = len < run - len ? len : run - len;
+        m &= m >> shift | next << (64 - shift);
+        next &= next >> shift;
+        len += shift;
+    }
+    return m;
+}
+
+/**
+ * Searches the bitmap for run granules in a row that are not in use.
+ * The first word that is not full is checked on its own, it was usually written just before. The rest is searched
+ * with vectors, the same way runsInWord does for one word: bit j of m is set where granules j .. j + len - 1 are free.
+ * Each step combines m with itself shifted by up to len, so a run of 8 takes three steps. The bits of the next word
+ * complete runs that cross into it, they only need to be right for its first few granules. Full words drop out
+ * without a branch.
+ * @return First granule of the run, -1 if there is none
+ */
+static int findRun(bitmapPage *p, int run) {
+    int first = p->firstWord;
+    if (first >= BITMAP_WORDS) {
+        return -1;
+    }
+    uint64_t m = runsInWord(p, first, run);
+    if (m) {
+        return first * 64 + __builtin_ctzll(m);
+    }
+#if defined(BITMAP_AVX2)
+    for (int w = (first + 1) & ~3; w < BITMAP_WORDS; w += 4) {
+        __m256i m = ~_mm256_loadu_si256((__m256i *) &p->used[w]);
+        __m256i next = ~_mm256_loadu_si256((__m256i *) &p->used[w + 1]);
+        for (int len = 1; len < run;) {
+            int shift = len < run - len ? len : run - len;
+            __m128i right = _mm_cvtsi32_si128(shift);
+            m &= _mm256_srl_epi64(m, right) | _mm256_sll_epi64(next, _mm_cvtsi32_si128(64 - shift));
+            next &= _mm256_srl_epi64(next, right);
+            len += shift;
+        }
+        if (!_mm256_testz_si256(m, m)) {
+            int zero = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(m, _mm256_setzero_si256())));
+            uint64_t lanes[4];
+            _mm256_storeu_si256((__m256i *) lanes, m);
+            int lane = __builtin_ctz(~zero);
+            return (w + lane) * 64 + __builtin_ctzll(lanes[lane]);
+        }
+    }
+#elif defined(BITMAP_SSE2)
+    for (int w = (first + 1) & ~1; w < BITMAP_WORDS; w += 2) {
+        __m128i m = ~_mm_loadu_si128((__m128i *) &p->used[w]);
+        __m128i next = ~_mm_loadu_si128((__m128i *) &p->used[w + 1]);
+        for (int len = 1; len < run;) {
+            int shift = len < run - len ? len : run - len;
+            __m128i right = _mm_cvtsi32_si128(shift);
+            m &= _mm_srl_epi64(m, right) | _mm_sll_epi64(next, _mm_cvtsi32_si128(64 - shift));
+            next &= _mm_srl_epi64(next, right);
+            len += shift;
+        }
+        int zero = _mm_movemask_epi8(_mm_cmpeq_epi8(m, _mm_setzero_si128()));
+        if (zero != 0xffff) {
+            uint64_t lanes[2];
+            _mm_storeu_si128((__m128i *) lanes, m);
+            int lane = (zero & 0xff) == 0xff;
+            return (w + lane) * 64 + __builtin_ctzll(lanes[lane]);
+        }
+    }
+#else
+    for (int w = first + 1; w < BITMAP_WORDS; ++w) {
+        m = runsInWord(p, w, run);
+        if (m) {
+            return w * 64 + __builtin_ctzll(m);
+        }
+    }
+#endif
+    return -1;
+}
+
+// Sets or clears count bits of a bitmap, starting at bit first
+static void flipRun(uint64_t *bits, uint32_t first, uint32_t count) {
+    uint32_t w = first / 64;
+    uint32_t b = first % 64;
+    uint32_t inWord = count < 64 - b ? count : 64 - b;
+    bits[w] ^= (((uint64_t) 1 << inWord) - 1) << b;
+    if (inWord < count) {
+        bits[w + 1] ^= ((uint64_t) 1 << (count - inWord)) - 1;
+    }
+}
+
+void *bitmapAlloc(size_t size) {
+    int run = size <= GRANULE ? 1 : (int) ((size + GRANULE - 1) / GRANULE);
+    int g = -1;
+    bitmapPage *p;
+    for (p = partialPages; p; p = p->next) {
+        if (p->freeGranules >= (uint32_t) run) {
+            g = findRun(p, run);
+            if (g >= 0) {
+                break;
+            }
+        }
+        unlinkPage(p);
+    }
+    if (g < 0) {
+        p = newBitmapPage();
+        if (!p) {
+            return 0;
+        }
+        g = findRun(p, run);
+    }
+
+    flipRun(p->used, g, run);
+    p->ends[(g + run - 1) / 64] |= (uint64_t) 1 << ((g + run - 1) % 64);
+    p->freeGranules -= run;
+    allocStats->liveBytes += run * GRANULE;
+    if (p->used[p->firstWord] == ~(uint64_t) 0) {
+        // Only one step, findRun skips further full words anyway
+        p->firstWord++;
+    }
+    if (p->freeGranules == 0) {
+        unlinkPage(p);
+    }
+    TRACE(ALLOC, (void *) p + g * GRANULE, run * GRANULE, MY_TRACE_BITMAP, 0);
+    return (void *) p + g * GRANULE;
+}
+
+void bitmapFree(void *ptr) {
+    bitmapPage *p = pageOf(ptr);
+    uint32_t g = (uint32_t) (ptr - (void *) p) / GRANULE;
+
+    // The object ends at the next end bit
+    uint64_t following = p->ends[g / 64] >> (g % 64);
+    uint32_t last = following ? g + __builtin_ctzll(following) : (g / 64 + 1) * 64 + __builtin_ctzll(p->ends[g / 64 + 1]);
+    uint32_t run = last - g + 1;
+    TRACE(FREE, ptr, run * GRANULE, MY_TRACE_BITMAP, 0);
+
+    flipRun(p->used, g, run);
+    p->ends[last / 64] &= ~((uint64_t) 1 << (last % 64));
+    // Move to front: the next allocation reuses the granules still in cache
+    if (p != partialPages) {
+        if (p->linked) {
+            unlinkPage(p);
+        }
+        linkPage(p);
+    }
+    p->freeGranules += run;
+    allocStats->liveBytes -= run * GRANULE;
+    if (g / 64 < p->firstWord) {
+        p->firstWord = g / 64;
+    }
+
+    if (p->freeGranules == BITMAP_GRANULES - META_GRANULES && partialPages->next) {
+        // Page is empty and there are others to allocate from: make it available for any size
+        unlinkPage(p);
+        setFrames(p, 0);
+        allocStats->bitmapPages--;
+        formatPage(p);
+        insertFreeSpace((void *) p + sizeof(header));
+    }
+}
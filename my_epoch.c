@@ -0,0 +1,197 @@
+#include <pthread.h>
+#include <sched.h>
+
+#include "my_alloc_internal.h"
+
+// Epoch-based reclamation.
+// A global epoch counts up while threads read shared objects. A thread in a read section announces the epoch it
+// entered in, objects deferred in epoch e wait in limbo[e % 3]. The epoch only moves from e to e + 1 once every
+// thread in a read section entered in e, so nobody can still see an object deferred in e - 2 then, and that bag is
+// freed: in one go, under the lock, with the usual coalescing of each object with its neighbours.
+// Objects that wait must stay untouched, so their addresses are kept in batches allocated separately.
+
+// Objects per batch, which makes a batch 1 KiB
+#define BATCH_OBJECTS 126
+// Set in the state of a reader inside a read section, the epoch it entered in is above it
+#define ACTIVE 1
+
+typedef struct batch {
+    struct batch *next;  // Older batch of the same epoch
+    uint64_t count;
+    void *objects[BATCH_OBJECTS];
+} batch;
+
+// A thread that entered a read section once. Records are reused after their thread exits, but never freed.
+typedef struct reader {
+    uint64_t state;  // epoch << 1 | ACTIVE inside a read section, 0 outside
+    uint64_t exits;  // Read sections left, to wait for a reader that may enter again meanwhile
+    struct reader *next;
+    int used;
+    // A cache line each, the states are written by their threads and read by all
+    char padding[64 - 2 * sizeof(uint64_t) - sizeof(void *) - sizeof(int)];
+} reader;
+
+static uint64_t globalEpoch = 0;
+static batch *limbo[3];
+static reader *readers = 0;
+
+static __thread reader *self = 0;
+static __thread int nesting = 0;
+
+static pthread_once_t keyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t readerKey;
+
+// Hands the record of an exiting thread to the next thread that enters
+static void releaseReader(void *r) {
+    lockAlloc();
+    __atomic_store_n(&((reader *) r)->state, 0, __ATOMIC_RELEASE);
+    ((reader *) r)->used = 0;
+    unlockAlloc();
+}
+
+static void createKey() {
+    pthread_key_create(&readerKey, releaseReader);
+}
+
+static int registerReader() {
+    pthread_once(&keyOnce, createKey);
+    lockAlloc();
+    reader *r = readers;
+    while (r && r->used) {
+        r = r->next;
+    }
+    if (!r) {
+        r = allocateObject(sizeof(reader), MY_LONG_LIVED);
+        if (!r) {
+            unlockAlloc();
+            return -1;
+        }
+        r->state = 0;
+        r->exits = 0;
+        r->next = readers;
+        readers = r;
+    }
+    r->used = 1;
+    unlockAlloc();
+    pthread_setspecific(readerKey, r);
+    self = r;
+    return 0;
+}
+
+int my_epoch_enter() {
+    if (!self && registerReader() < 0) {
+        return -1;
+    }
+    if (nesting++ == 0) {
+        // A stale epoch only holds the next one back
+        uint64_t e = __atomic_load_n(&globalEpoch, __ATOMIC_RELAXED);
+        __atomic_store_n(&self->state, e << 1 | ACTIVE, __ATOMIC_RELAXED);
+        // The announcement must be visible before the first shared object is read
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    return 0;
+}
+
+void my_epoch_exit() {
+    if (--nesting == 0) {
+        __atomic_store_n(&self->state, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&self->exits, self->exits + 1, __ATOMIC_RELEASE);
+    }
+}
+
+// Frees the objects of a bag and its batches
+static size_t freeBag(batch **bag) {
+    size_t freed = 0;
+    batch *b = *bag;
+    *bag = 0;
+    while (b) {
+        batch *next = b->next;
+        for (uint64_t i = 0; i < b->count; ++i) {
+            freeAnyObject(b->objects[i]);
+        }
+        freed += b->count;
+        freeObject(b);
+        b = next;
+    }
+    allocStats->deferredObjects -= freed;
+    return freed;
+}
+
+/**
+ * Moves to the next epoch if every reader in a read section entered in the current one, and frees the objects that
+ * were deferred two epochs before it.
+ * @return Whether the epoch moved
+ */
+static int advance() {
+    uint64_t e = globalEpoch;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (reader *r = readers; r; r = r->next) {
+        uint64_t s = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE);
+        if (s & ACTIVE && s >> 1 != e) {
+            return 0;
+        }
+    }
+    __atomic_store_n(&globalEpoch, e + 1, __ATOMIC_SEQ_CST);
+    freeBag(&limbo[(e + 1) % 3]);
+    return 1;
+}
+
+int reclaimDeferred() {
+    size_t waiting = allocStats->deferredObjects;
+    // Three epochs free all bags
+    for (int i = 0; i < 3 && allocStats->deferredObjects && advance(); ++i) {
+    }
+    return allocStats->deferredObjects < waiting;
+}
+
+// Waits until every other thread left the read section it is in. The lock is released meanwhile.
+static void waitForReaders() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (reader *r = readers; r; r = r->next) {
+        if (r == self) {
+            continue;
+        }
+        uint64_t exits = __atomic_load_n(&r->exits, __ATOMIC_ACQUIRE);
+        if (!(__atomic_load_n(&r->state, __ATOMIC_ACQUIRE) & ACTIVE)) {
+            continue;
+        }
+        unlockAlloc();
+        while (__atomic_load_n(&r->state, __ATOMIC_ACQUIRE) & ACTIVE &&
+               __atomic_load_n(&r->exits, __ATOMIC_ACQUIRE) == exits) {
+            sched_yield();
+        }
+        lockAlloc();
+    }
+}
+
+void my_free_deferred(void *ptr) {
+    lockAlloc();
+    batch *b = limbo[globalEpoch % 3];
+    if (!b || b->count == BATCH_OBJECTS) {
+        // A batch is full: a good time to see whether the readers moved on
+        advance();
+        // May reclaim deferred objects itself and move the epoch
+        batch *more = allocateObject(sizeof(batch), 0);
+        if (!more) {
+            // Nowhere to keep it, wait until nobody can see it
+            waitForReaders();
+            freeAnyObject(ptr);
+            unlockAlloc();
+            return;
+        }
+        more->next = limbo[globalEpoch % 3];
+        more->count = 0;
+        limbo[globalEpoch % 3] = b = more;
+    }
+    b->objects[b->count++] = ptr;
+    allocStats->deferredObjects++;
+    unlockAlloc();
+}
+
+size_t my_epoch_reclaim() {
+    lockAlloc();
+    reclaimDeferred();
+    size_t waiting = allocStats->deferredObjects;
+    unlockAlloc();
+    return waiting;
+}
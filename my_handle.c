@@ -0,0 +1,248 @@
+#include <string.h>
+
+#include "my_alloc_internal.h"
+
+// Handles and online compaction.
+// Objects behind handles live in MOVABLE_POOL. The first 8 bytes of every such object hold its handle, so the
+// compactor can find the handle of each object it walks over.
+// Every page of the pool has an entry in the page table with its live bytes, the frame map leads from an object
+// to that entry.
+
+// Tables of 16 byte entries in blocks from newBlock. Index 0 is never handed out.
+#define TABLE_CHUNK (BLOCKSIZE / sizeof(slot))
+#define TABLE_CHUNKS 16384
+
+// Pages fuller than this are not worth evacuating
+#define COMPACT_THRESHOLD (PAGE_SPACE / 2)
+
+typedef struct slot {
+    void *ptr;  // Object or page, 0 if the slot is unused
+    uint32_t value;  // Handle: pins. Page: live bytes. Unused: next free slot
+    uint32_t tried;  // Page: evacuation failed, don't try again until something on it is freed
+} slot;
+
+typedef struct table {
+    slot *chunks[TABLE_CHUNKS];
+    uint32_t size;  // Slots in use or on the free list
+    uint32_t nextFree;
+} table;
+
+static table handles;
+static table pages;
+
+static slot *slotOf(table *t, uint32_t index) {
+    return &t->chunks[index / TABLE_CHUNK][index % TABLE_CHUNK];
+}
+
+// Returns the index of an unused slot, 0 if there is no memory left
+static uint32_t takeSlot(table *t) {
+    if (t->nextFree) {
+        uint32_t index = t->nextFree;
+        t->nextFree = slotOf(t, index)->value;
+        return index;
+    }
+    if (t->size == 0) {
+        t->size = 1;
+    }
+    uint32_t chunk = t->size / TABLE_CHUNK;
+    if (chunk >= TABLE_CHUNKS) {
+        return 0;
+    }
+    if (!t->chunks[chunk]) {
+        t->chunks[chunk] = newBlock();
+        if (!t->chunks[chunk]) {
+            return 0;
+        }
+    }
+    return t->size++;
+}
+
+static void releaseSlot(table *t, uint32_t index) {
+    slot *s = slotOf(t, index);
+    s->ptr = 0;
+    s->value = t->nextFree;
+    t->nextFree = index;
+}
+
+static void setFrames(page *p, uint32_t value) {
+    for (int i = 0; i < FRAMES_PER_BLOCK; ++i) {
+        *frameOf(p + (i << FRAME_SHIFT)) = value;
+    }
+}
+
+void registerMovablePage(page *p) {
+    uint32_t index = takeSlot(&pages);
+    if (!index) {
+        // Page stays unknown to the compactor
+        return;
+    }
+    slot *s = slotOf(&pages, index);
+    s->ptr = p;
+    s->value = 0;
+    s->tried = 0;
+    setFrames(p, index);
+}
+
+void unregisterMovablePage(page *p) {
+    uint32_t index = *frameOf(p);
+    if (index) {
+        releaseSlot(&pages, index);
+        setFrames(p, 0);
+    }
+}
+
+// Adds to the live bytes of the page object is on
+static void addLive(void *object, int32_t bytes) {
+    uint32_t index = *frameOf(object);
+    if (index) {
+        slot *p = slotOf(&pages, index);
+        p->value += bytes;
+        p->tried = 0;
+    }
+}
+
+my_handle my_halloc(size_t size) {
+    lockAlloc();
+    uint32_t index = takeSlot(&handles);
+    // Room for the handle in front, rounded to whole headers
+    size = (size + sizeof(uint64_t) + 7) & ~(size_t) 7;
+    void *object = index ? allocateObject(size, MOVABLE_POOL) : 0;
+    if (!object) {
+        if (index) {
+            releaseSlot(&handles, index);
+        }
+        allocStats->failedAllocations++;
+        unlockAlloc();
+        return 0;
+    }
+    *(uint64_t *) object = index;
+    slot *h = slotOf(&handles, index);
+    h->ptr = object;
+    h->value = 0;
+    addLive(object, realSize(headerOf(object)->tailingObjectSize));
+    allocStats->allocations++;
+    unlockAlloc();
+    return index;
+}
+
+void *my_hpin(my_handle h) {
+    lockAlloc();
+    slot *s = slotOf(&handles, h);
+    s->value++;
+    unlockAlloc();
+    return s->ptr + sizeof(uint64_t);
+}
+
+void my_hunpin(my_handle h) {
+    lockAlloc();
+    slotOf(&handles, h)->value--;
+    unlockAlloc();
+}
+
+void my_hfree(my_handle h) {
+    lockAlloc();
+    allocStats->frees++;
+    void *object = slotOf(&handles, h)->ptr;
+    addLive(object, -(int32_t) realSize(headerOf(object)->tailingObjectSize));
+    releaseSlot(&handles, h);
+    // An emptied page leaves the pool in insertFreeSpace
+    freeObject(object);
+    unlockAlloc();
+}
+
+// Sparsest page of the pool that may be worth evacuating, 0 if there is none
+static uint32_t findVictim() {
+    uint32_t victim = 0;
+    uint32_t least = COMPACT_THRESHOLD + 1;
+    for (uint32_t i = 1; i < pages.size; ++i) {
+        slot *p = slotOf(&pages, i);
+        if (p->ptr && !p->tried && p->value < least) {
+            victim = i;
+            least = p->value;
+        }
+    }
+    return victim;
+}
+
+// Moves the unpinned objects of a page elsewhere in the pool.
+// Returns whether the page is empty afterwards, it has been handed to emptyPages then.
+static int evacuate(uint32_t victim) {
+    page *p = slotOf(&pages, victim)->ptr;
+    void *end = p + BLOCKSIZE;
+    void *object;
+
+    // Keep the free space of this page out of reach of the allocations below
+    for (object = p + sizeof(header); object < end; object += realSize(headerOf(object)->tailingObjectSize) + sizeof(header)) {
+        if (headerOf(object)->tailingObjectSize & 1) {
+            removeFreeSpaceFromList(object);
+        }
+    }
+
+    // Move objects, leaving free spaces that are in no list
+    int empty = 1;
+    noNewPages = 1;
+    for (object = p + sizeof(header); object < end; object += realSize(headerOf(object)->tailingObjectSize) + sizeof(header)) {
+        header *h = headerOf(object);
+        if (h->tailingObjectSize & 1) {
+            continue;
+        }
+        uint32_t size = realSize(h->tailingObjectSize);
+        slot *handle = slotOf(&handles, (uint32_t) *(uint64_t *) object);
+        void *moved = handle->value ? 0 : allocateObject(size, MOVABLE_POOL);
+        if (!moved) {
+            // Pinned, or no space left in the other pages
+            empty = 0;
+            continue;
+        }
+        memcpy(moved, object, size);
+        handle->ptr = moved;
+        addLive(moved, realSize(headerOf(moved)->tailingObjectSize));
+        addLive(object, -(int32_t) size);
+        h->tailingObjectSize |= 1;
+        footerOf(object)->precedingObjectSize |= 1;
+        allocStats->liveBytes -= size;
+    }
+    noNewPages = 0;
+
+    if (empty) {
+        unregisterMovablePage(p);
+        formatPage(p);
+        insertFreeSpace(p + sizeof(header));
+        return 1;
+    }
+
+    // Merge neighbouring free spaces and put them back into the lists
+    slotOf(&pages, victim)->tried = 1;
+    for (object = p + sizeof(header); object < end; object += realSize(headerOf(object)->tailingObjectSize) + sizeof(header)) {
+        if (!(headerOf(object)->tailingObjectSize & 1)) {
+            continue;
+        }
+        uint32_t size = realSize(headerOf(object)->tailingObjectSize);
+        while (footerOf(object)->tailingObjectSize & 1) {
+            size += sizeof(header) + realSize(footerOf(object)->tailingObjectSize);
+            headerOf(object)->tailingObjectSize = size | (MOVABLE_POOL << POOL_SHIFT) | 1;
+        }
+        footerOf(object)->precedingObjectSize = size | 1;
+        insertFreeSpace(object);
+    }
+    return 0;
+}
+
+size_t compact(size_t maxPages) {
+    size_t released = 0;
+    for (size_t i = 0; i < maxPages; ++i) {
+        uint32_t victim = findVictim();
+        if (!victim) {
+            break;
+        }
+        released += evacuate(victim);
+    }
+    return released;
+}
+
+size_t my_hcompact(size_t maxPages) {
+    lockAlloc();
+    size_t released = compact(maxPages);
+    unlockAlloc();
+    return released;
+}
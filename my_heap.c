@@ -0,0 +1,155 @@
+#include "my_alloc_internal.h"
+
+// Heap instances.
+// A my_heap has free lists of its own, the allocator works on them instead of defaultLists while one of the my_heap
+// functions runs. Pages have no room to link them, so the blocks of a heap are listed in directory blocks. The first
+// directory shares its block with the heap itself. The pages of a shared heap come from its region instead (my_shared.c).
+
+// Block listing blocks of a heap
+typedef struct directory {
+    struct directory *next;  // Previous directory, 0 for the first one
+    uint32_t count;
+    uint32_t capacity;
+    void *blocks[];
+} directory;
+
+// Heap whose lists are heapLists
+static my_heap *current = 0;
+
+// Reuses an empty page of my_alloc if there is one, new block otherwise
+static void *takeBlock() {
+    doublePointer *space = defaultLists.emptyPages;
+    if (!space) {
+        return newBlock();
+    }
+    struct freeLists *lists = heapLists;
+    heapLists = &defaultLists;
+    removeFreeSpaceFromList(space);
+    heapLists = lists;
+    return (void *) space - sizeof(header);
+}
+
+static void initDirectory(directory *d, directory *next, size_t bytes) {
+    d->next = next;
+    d->count = 0;
+    d->capacity = (uint32_t) ((bytes - sizeof(directory)) / sizeof(void *));
+}
+
+void *heapPage() {
+    if (current->shared) {
+        return sharedPage(current->shared);
+    }
+    directory *d = current->directory;
+    if (d->count == d->capacity) {
+        directory *more = takeBlock();
+        if (!more) {
+            return 0;
+        }
+        initDirectory(more, d, BLOCKSIZE);
+        current->directory = d = more;
+    }
+    page *p = takeBlock();
+    if (!p) {
+        return 0;
+    }
+    d->blocks[d->count++] = p;
+    formatPage(p);
+    return p;
+}
+
+my_heap *my_heap_create() {
+    lockAlloc();
+    my_heap *heap = takeBlock();
+    if (heap) {
+        heap->lists = (struct freeLists) {0};
+        heap->directory = (directory *) (heap + 1);
+        heap->shared = 0;
+        initDirectory(heap->directory, 0, BLOCKSIZE - sizeof(my_heap));
+    }
+    unlockAlloc();
+    return heap;
+}
+
+// Makes the allocator work on the lists of the heap, under the allocator lock. Returns -1 if the heap can't be used.
+static int enterHeap(my_heap *heap) {
+    lockAlloc();
+    heapLists = &heap->lists;
+    current = heap;
+    if (heap->shared && enterShared(heap->shared) < 0) {
+        heapLists = &defaultLists;
+        current = 0;
+        unlockAlloc();
+        return -1;
+    }
+    return 0;
+}
+
+static void leaveHeap(my_heap *heap) {
+    if (heap->shared) {
+        leaveShared(heap->shared);
+    }
+    heapLists = &defaultLists;
+    current = 0;
+    unlockAlloc();
+}
+
+void *my_heap_alloc(my_heap *heap, size_t size) {
+    if (enterHeap(heap) < 0) {
+        return 0;
+    }
+    void *object = allocateObject(size, 0);
+    if (object) {
+        allocStats->allocations++;
+    } else {
+        allocStats->failedAllocations++;
+    }
+    leaveHeap(heap);
+    return object;
+}
+
+void my_heap_free(my_heap *heap, void *ptr) {
+    if (enterHeap(heap) < 0) {
+        return;
+    }
+    allocStats->frees++;
+    freeObject(ptr);
+    leaveHeap(heap);
+}
+
+// Takes the objects and free spaces of a page of a heap out of the counters
+static void forgetPage(page *p) {
+    void *object = p + sizeof(header);
+    for (uint32_t s; (s = headerOf(object)->tailingObjectSize) != END_OF_PAGE; object += realSize(s) + sizeof(header)) {
+        if (!(s & 1)) {
+            allocStats->liveBytes -= realSize(s);
+            allocStats->frees++;
+        } else if (realSize(s) == PAGE_SPACE) {
+            allocStats->emptyPages--;
+        } else {
+            allocStats->freeSpaces[poolOf(s)][bucketIndex(realSize(s))]--;
+        }
+    }
+}
+
+void my_heap_destroy(my_heap *heap) {
+    if (heap->shared) {
+        detachShared(heap->shared);
+        return;
+    }
+    lockAlloc();
+    directory *d = heap->directory;
+    while (d) {
+        directory *next = d->next;
+        for (uint32_t i = 0; i < d->count; ++i) {
+            forgetPage(d->blocks[i]);
+            formatPage(d->blocks[i]);
+            insertFreeSpace(d->blocks[i] + sizeof(header));
+        }
+        // The first directory is in the block of the heap, which goes last
+        page *p = next ? (page *) d : (page *) heap;
+        formatPage(p);
+        insertFreeSpace(p + sizeof(header));
+        d = next;
+    }
+    unlockAlloc();
+}
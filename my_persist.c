@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "my_alloc_internal.h"
+
+// File-backed persistent heap.
+// The file is mapped at a fixed address, so all pointers stored inside the heap (boundary tags are sizes anyway,
+// free list links are offsets against pointerBase) stay valid across restarts.
+// Layout: one superblock followed by the pages handed out by persistentBlock.
+// The superblock keeps the list heads as of the last sync. It is marked dirty while a process works on the heap, and
+// a process that opens a dirty heap builds the lists from the pages instead.
+
+// The file starts the window of pointerBase, whatever the process mapped before
+#define PERSIST_BASE ((void *) 0x100000000000)
+// Maximum heap size, the free list links can't address more than 4 GiB
+#define PERSIST_MAX ((size_t) 1 << 32)
+// The file is grown by this many bytes at a time
+#define PERSIST_GROW ((size_t) 128 * BLOCKSIZE)
+
+#define PERSIST_MAGIC 0x36434f4c4c41594dULL // "MYALLOC6"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+typedef struct superblock {
+    uint64_t magic;
+    uint64_t base;  // Address the file has to be mapped at
+    uint64_t blockCount;  // Pages handed out after the superblock
+    uint64_t root;
+    uint64_t sizeClasses;  // SIZE_CLASSES_ID of the table the lists were built with
+    uint64_t sampled;  // The heap profiler marked objects, their SAMPLED bits are stale after a restart
+    uint64_t dirty;  // A process has the heap open and changed it since the lists were stored
+    uint64_t buckets[NUMBER_OF_POOLS][NUMBER_OF_LISTS];
+    uint64_t emptyPages;
+} superblock;
+
+static superblock *super;
+static int persistFd = -1;
+// Bytes of the file currently mapped
+static size_t mapped;
+
+// Maps [mapped, size) of the file, growing the file if necessary
+static int mapFile(size_t size) {
+    struct stat st;
+    if (fstat(persistFd, &st) < 0) {
+        return -1;
+    }
+    if ((size_t) st.st_size < size && ftruncate(persistFd, (off_t) size) < 0) {
+        return -1;
+    }
+    void *want = (char *) PERSIST_BASE + mapped;
+    void *got = mmap(want, size - mapped, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, persistFd, (off_t) mapped);
+    if (got != want) {
+        return -1;
+    }
+    mapped = size;
+    return 0;
+}
+
+// Block source replacing get_block_from_system
+static void *persistentBlock() {
+    size_t end = (super->blockCount + 2) * BLOCKSIZE;
+    if (end > mapped) {
+        size_t size = mapped + PERSIST_GROW;
+        if (size > PERSIST_MAX || mapFile(size) < 0) {
+            return NULL;
+        }
+    }
+    return (char *) PERSIST_BASE + ++super->blockCount * BLOCKSIZE;
+}
+
+// Sets the dirty word on disk before the pages change any further
+static int markDirty() {
+    super->dirty = 1;
+    return msync(super, sizeof(superblock), MS_SYNC);
+}
+
+// Stores the lists and flushes the file. The heap stays dirty unless the process is about to exit.
+static int storeLists(int exiting) {
+    lockAlloc();
+    // The file only keeps the lists
+    retireActiveSpaces();
+    for (int pool = 0; pool < NUMBER_OF_POOLS; ++pool) {
+        for (int i = 0; i < NUMBER_OF_LISTS; ++i) {
+            super->buckets[pool][i] = (uintptr_t) defaultLists.buckets[pool][i];
+        }
+    }
+    super->emptyPages = (uintptr_t) defaultLists.emptyPages;
+    super->dirty = 0;
+    int result = msync(PERSIST_BASE, mapped, MS_SYNC);
+    if (result == 0 && !exiting) {
+        result = markDirty();
+    }
+    unlockAlloc();
+    return result;
+}
+
+int my_alloc_persistent_sync() {
+    if (!super) {
+        errno = EINVAL;
+        return -1;
+    }
+    return storeLists(0);
+}
+
+int releaseMemory(void *start, size_t size) {
+    if (!super) {
+        return madvise(start, size, MADV_DONTNEED);
+    }
+    // MADV_DONTNEED keeps the contents of a shared file mapping, a hole frees them and reads back as zeros
+    return fallocate(persistFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t) (start - PERSIST_BASE),
+                     (off_t) size);
+}
+
+void persistentSampled() {
+    if (super) {
+        super->sampled = 1;
+    }
+}
+
+/**
+ * Checks that the boundary tags of a block add up to a whole page. Arena blocks, handle tables and heap directories
+ * are blocks of the file as well, but not pages.
+ */
+static int isTaggedPage(void *block) {
+    void *object = block + sizeof(header);
+    if (headerOf(object)->precedingObjectSize != START_OF_PAGE) {
+        return 0;
+    }
+    for (uint32_t s; (s = headerOf(object)->tailingObjectSize) != END_OF_PAGE;) {
+        object += realSize(s) + sizeof(header);
+        if (object > block + BLOCKSIZE || realSize(headerOf(object)->precedingObjectSize) != realSize(s)) {
+            return 0;
+        }
+    }
+    return object == block + BLOCKSIZE;
+}
+
+// Clears the SAMPLED bits a previous process left in the footers, the samples they stood for are gone
+static void clearSampled() {
+    for (uint64_t n = 1; n <= super->blockCount; ++n) {
+        void *block = (char *) PERSIST_BASE + n * BLOCKSIZE;
+        if (!isTaggedPage(block)) {
+            continue;
+        }
+        void *object = block + sizeof(header);
+        for (uint32_t s; (s = headerOf(object)->tailingObjectSize) != END_OF_PAGE;) {
+            object += realSize(s) + sizeof(header);
+            headerOf(object)->precedingObjectSize &= ~(uint32_t) SAMPLED;
+        }
+    }
+    super->sampled = 0;
+}
+
+/**
+ * Builds the lists anew from the boundary tags of all pages, for a heap whose last process did not store them: the
+ * stored heads may point at spaces that were allocated, split or merged since.
+ * Free spaces of whole pages lose their pool, like the empty pages of a running heap.
+ */
+static void rebuildLists() {
+    defaultLists = (struct freeLists) {0};
+    for (uint64_t n = 1; n <= super->blockCount; ++n) {
+        void *block = (char *) PERSIST_BASE + n * BLOCKSIZE;
+        if (!isTaggedPage(block)) {
+            continue;
+        }
+        void *object = block + sizeof(header);
+        if (headerOf(object)->tailingObjectSize & 1 && realSize(headerOf(object)->tailingObjectSize) == PAGE_SPACE) {
+            formatPage(block);
+        }
+        for (uint32_t s; (s = headerOf(object)->tailingObjectSize) != END_OF_PAGE;) {
+            if (s & 1) {
+                insertFreeSpace(object);
+            }
+            object += realSize(s) + sizeof(header);
+        }
+    }
+}
+
+static void syncAtExit() {
+    storeLists(1);
+}
+
+int my_alloc_persistent(const char *path) {
+    if (super) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    persistFd = open(path, O_RDWR | O_CREAT, 0600);
+    if (persistFd < 0) {
+        return -1;
+    }
+
+    // Reserve the whole address range so nothing else ends up where the heap may grow
+    void *reserved = mmap(PERSIST_BASE, PERSIST_MAX, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+    if (reserved != PERSIST_BASE) {
+        if (reserved != MAP_FAILED) {
+            munmap(reserved, PERSIST_MAX);
+        }
+        close(persistFd);
+        errno = EADDRINUSE;
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(persistFd, &st) < 0 || mapFile(st.st_size > BLOCKSIZE ? (size_t) st.st_size : PERSIST_GROW) < 0) {
+        goto fail;
+    }
+    super = PERSIST_BASE;
+
+    if (super->magic == 0) {
+        // Fresh file
+        super->magic = PERSIST_MAGIC;
+        super->base = (uintptr_t) PERSIST_BASE;
+        super->sizeClasses = SIZE_CLASSES_ID;
+    } else if (super->magic != PERSIST_MAGIC || super->base != (uintptr_t) PERSIST_BASE ||
+               super->sizeClasses != SIZE_CLASSES_ID) {
+        super = 0;
+        errno = EINVAL;
+        goto fail;
+    }
+
+    int dirty = (int) super->dirty;
+    if (markDirty() < 0) {
+        super = 0;
+        goto fail;
+    }
+    pointerBase = (uintptr_t) PERSIST_BASE;
+    if (super->sampled) {
+        clearSampled();
+    }
+    if (dirty) {
+        // The last process crashed or left without syncing
+        rebuildLists();
+    } else {
+        // Warm restart: resume allocating from the persisted free lists
+        for (int pool = 0; pool < NUMBER_OF_POOLS; ++pool) {
+            for (int i = 0; i < NUMBER_OF_LISTS; ++i) {
+                defaultLists.buckets[pool][i] = (doublePointer *) super->buckets[pool][i];
+                if (defaultLists.buckets[pool][i]) {
+                    defaultLists.nonEmptyBuckets[pool] |= (uint64_t) 1 << i;
+                }
+            }
+        }
+        defaultLists.emptyPages = (doublePointer *) super->emptyPages;
+    }
+    countFreeSpaces();
+    blockSource = persistentBlock;
+    // The frame map telling bitmap pages apart is not part of the file, the span region is not mapped from it
+    bitmapPages = 0;
+    spans = 0;
+    atexit(syncAtExit);
+    return 0;
+
+    fail:
+    {
+        int err = errno;
+        munmap(PERSIST_BASE, PERSIST_MAX);
+        close(persistFd);
+        persistFd = -1;
+        mapped = 0;
+        errno = err;
+    }
+    return -1;
+}
+
+void *my_alloc_persistent_root() {
+    return super ? (void *) super->root : 0;
+}
+
+void my_alloc_persistent_set_root(void *root) {
+    if (super) {
+        super->root = (uintptr_t) root;
+    }
+}
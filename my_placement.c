@@ -0,0 +1,87 @@
+#include "my_alloc_internal.h"
+
+// Locality placement.
+// The bucket lists are LIFO stacks of free spaces from every page, so objects allocated one after another usually
+// land on unrelated pages. In MY_PLACEMENT_LOCAL mode each pool has an active free space instead, taken out of the
+// lists, and objects are cut from its start one after another. When it is too small, the other free spaces of its
+// page are tried before the largest free space of the pool becomes the next active one.
+
+int placement = MY_PLACEMENT_BUCKETS;
+void *activeSpaces[NUMBER_OF_POOLS];
+
+void retireActiveSpaces() {
+    for (int pool = 0; pool < NUMBER_OF_POOLS; ++pool) {
+        if (activeSpaces[pool]) {
+            insertFreeSpace(activeSpaces[pool]);
+            activeSpaces[pool] = 0;
+        }
+    }
+}
+
+void my_alloc_set_placement(int mode) {
+    lockAlloc();
+    retireActiveSpaces();
+    placement = mode == MY_PLACEMENT_LOCAL ? MY_PLACEMENT_LOCAL : MY_PLACEMENT_BUCKETS;
+    unlockAlloc();
+}
+
+/**
+ * Walks the page an object is on, from its first object on.
+ * @return First free space of at least size, taken out of its list. 0 if the page has none.
+ */
+static void *freeSpaceOnPage(void *object, size_t size) {
+    while (headerOf(object)->precedingObjectSize != START_OF_PAGE) {
+        object -= realSize(headerOf(object)->precedingObjectSize) + sizeof(header);
+    }
+    for (uint32_t s; (s = headerOf(object)->tailingObjectSize) != END_OF_PAGE; object += realSize(s) + sizeof(header)) {
+        if (s & 1 && realSize(s) >= size) {
+            removeFreeSpaceFromList(object);
+            return object;
+        }
+    }
+    return 0;
+}
+
+/**
+ * The largest free space of the pool, which leaves the most room for the objects after this one.
+ * Only the head of the highest non-empty bucket is looked at, the rest is up to findFreeSpace.
+ * @return Free space of at least size, taken out of its list. 0 if out of memory.
+ */
+static void *largestFreeSpace(size_t size, int pool) {
+    void *object = 0;
+    uint64_t candidates = heapLists->nonEmptyBuckets[pool];
+    if (candidates) {
+        object = heapLists->buckets[pool][63 - __builtin_clzll(candidates)];
+        if (realSize(headerOf(object)->tailingObjectSize) < size) {
+            object = 0;
+        }
+    }
+    if (!object) {
+        object = findFreeSpace(size, pool);
+        if (!object) {
+            return 0;
+        }
+    }
+    removeFreeSpaceFromList(object);
+    return object;
+}
+
+void *allocateLocal(size_t size, int pool) {
+    void *object = activeSpaces[pool];
+    if (!object || realSize(headerOf(object)->tailingObjectSize) < size) {
+        if (object) {
+            // Used up, stay on its page if possible
+            activeSpaces[pool] = 0;
+            insertFreeSpace(object);
+            object = freeSpaceOnPage(object, size);
+        }
+        if (!object) {
+            object = largestFreeSpace(size, pool);
+            if (!object) {
+                return 0;
+            }
+        }
+    }
+    activeSpaces[pool] = splitFreeSpace(object, size, pool);
+    return object;
+}
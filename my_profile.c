@@ -0,0 +1,255 @@
+#include <errno.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "my_alloc_internal.h"
+
+// Sampling heap profiler.
+// bytesUntilSample counts down by every allocated size. When it drops below 0 the allocation is sampled: it goes
+// through sampleObject, which places it on a tagged page (or a span if it is larger), marks its footer (or span header)
+// and records its call stack here
+// until it is freed. The distances between samples are exponentially distributed, so every byte has the same chance
+// to be sampled, which is what pprof expects to scale the samples back up.
+
+#define DEFAULT_RATE (512 * 1024)
+#define MAX_DEPTH 32
+// Open addressing with linear probing, keyed by object address
+#define SAMPLE_BITS 16
+#define SAMPLE_SLOTS (1 << SAMPLE_BITS)
+#define MAX_SAMPLES (SAMPLE_SLOTS / 4 * 3)
+
+typedef struct sample {
+    void *object;  // 0 if the slot is unused
+    size_t size;
+    int depth;
+    void *stack[MAX_DEPTH];
+} sample;
+
+// Disabled: never reaches 0
+int64_t bytesUntilSample = INT64_MAX;
+
+static size_t sampleRate = DEFAULT_RATE;
+static int sampling = 0;
+static sample *samples = 0;
+static size_t sampleCount = 0;
+static uint64_t randomState = 0x9e3779b97f4a7c15;
+
+// Set by SIGUSR2, the next allocation writes the profile.
+// If the handler interrupts an update of bytesUntilSample, it is the next sampled allocation instead.
+static volatile sig_atomic_t dumpRequested = 0;
+static char signalPath[4096];
+
+static size_t slotOf(void *object) {
+    return ((uintptr_t) object >> 3) * 0x9e3779b97f4a7c15 >> (64 - SAMPLE_BITS);
+}
+
+// Exponentially distributed with mean sampleRate
+static int64_t nextDistance() {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 7;
+    randomState ^= randomState << 17;
+    // Uniform in (0, 1]
+    double u = ((randomState >> 11) + 1) * (1.0 / 9007199254740992.0);
+    return (int64_t) (-log(u) * sampleRate) + 1;
+}
+
+static void record(void *object, size_t size) {
+    if (sampleCount >= MAX_SAMPLES) {
+        // Full, the object stays unsampled
+        return;
+    }
+    size_t i = slotOf(object);
+    while (samples[i].object) {
+        i = (i + 1) % SAMPLE_SLOTS;
+    }
+    sample *s = &samples[i];
+    s->object = object;
+    s->size = size;
+    // Skip sampleObject itself, keep the my_alloc frame
+    s->depth = backtrace(s->stack, MAX_DEPTH) - 1;
+    if (s->depth < 0) {
+        s->depth = 0;
+    }
+    memmove(s->stack, s->stack + 1, s->depth * sizeof(void *));
+    sampleCount++;
+    if (isSpanObject(object)) {
+        spanMarkSampled(object);
+    } else {
+        footerOf(object)->precedingObjectSize |= SAMPLED;
+        persistentSampled();
+    }
+}
+
+void forgetSample(void *object) {
+    if (!samples) {
+        // Never profiled in this process, the mark is stale
+        return;
+    }
+    size_t i = slotOf(object);
+    while (samples[i].object != object) {
+        if (!samples[i].object) {
+            // Sampled before a restart of a persistent heap, or dropped from the table
+            return;
+        }
+        i = (i + 1) % SAMPLE_SLOTS;
+    }
+    samples[i].object = 0;
+    sampleCount--;
+
+    // Move later entries of the probe sequence back into the gap
+    size_t gap = i;
+    for (size_t j = (i + 1) % SAMPLE_SLOTS; samples[j].object; j = (j + 1) % SAMPLE_SLOTS) {
+        size_t home = slotOf(samples[j].object);
+        if ((j > gap && (home <= gap || home > j)) || (j < gap && home <= gap && home > j)) {
+            samples[gap] = samples[j];
+            samples[j].object = 0;
+            gap = j;
+        }
+    }
+}
+
+static int writeProfile(const char *path);
+
+void *sampleObject(size_t size, int pool) {
+    if (dumpRequested) {
+        dumpRequested = 0;
+        writeProfile(signalPath);
+    }
+    bytesUntilSample = sampling ? nextDistance() : INT64_MAX;
+    void *object = size > PAGE_SPACE && spans ? spanAlloc(size) : allocateObject(size, pool);
+    if (object && sampling) {
+        record(object, size);
+    }
+    return object;
+}
+
+static void requestDump(int signal) {
+    (void) signal;
+    dumpRequested = 1;
+    bytesUntilSample = 0;
+}
+
+int my_alloc_profile_start(size_t rate, const char *path) {
+    lockAlloc();
+    if (!samples) {
+        samples = mmap(0, SAMPLE_SLOTS * sizeof(sample), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (samples == MAP_FAILED) {
+            samples = 0;
+            unlockAlloc();
+            return -1;
+        }
+    }
+    sampleRate = rate ? rate : DEFAULT_RATE;
+    sampling = 1;
+    bytesUntilSample = nextDistance();
+    unlockAlloc();
+
+    if (path) {
+        if (strlen(path) >= sizeof(signalPath)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        strcpy(signalPath, path);
+        struct sigaction action = {.sa_handler = requestDump, .sa_flags = SA_RESTART};
+        sigemptyset(&action.sa_mask);
+        return sigaction(SIGUSR2, &action, 0);
+    }
+    return 0;
+}
+
+void my_alloc_profile_stop() {
+    lockAlloc();
+    sampling = 0;
+    bytesUntilSample = INT64_MAX;
+    unlockAlloc();
+}
+
+// Orders samples by stack, so equal stacks end up next to each other
+static int compareStacks(const void *a, const void *b) {
+    const sample *x = *(sample **) a;
+    const sample *y = *(sample **) b;
+    if (x->depth != y->depth) {
+        return x->depth - y->depth;
+    }
+    return memcmp(x->stack, y->stack, x->depth * sizeof(void *));
+}
+
+static void copyMaps(FILE *out) {
+    char buffer[4096];
+    int fd = open("/proc/self/maps", O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        fwrite(buffer, 1, n, out);
+    }
+    close(fd);
+}
+
+// Writes the live samples in the legacy text format of the gperftools heap profiler, merged by call stack
+static int writeProfile(const char *path) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        return -1;
+    }
+
+    size_t count = 0;
+    size_t bytes = 0;
+    sample **sorted = 0;
+    size_t sortedSize = (sampleCount + 1) * sizeof(sample *);
+    if (samples) {
+        sorted = mmap(0, sortedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (sorted == MAP_FAILED) {
+            fclose(out);
+            return -1;
+        }
+        for (size_t i = 0; i < SAMPLE_SLOTS; ++i) {
+            if (samples[i].object) {
+                sorted[count++] = &samples[i];
+                bytes += samples[i].size;
+            }
+        }
+        qsort(sorted, count, sizeof(sample *), compareStacks);
+    }
+
+    fprintf(out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n", count, bytes, count, bytes, sampleRate);
+    for (size_t i = 0; i < count;) {
+        size_t n = 0;
+        size_t b = 0;
+        size_t j = i;
+        for (; j < count && compareStacks(&sorted[i], &sorted[j]) == 0; ++j) {
+            n++;
+            b += sorted[j]->size;
+        }
+        fprintf(out, "%zu: %zu [%zu: %zu] @", n, b, n, b);
+        for (int k = 0; k < sorted[i]->depth; ++k) {
+            fprintf(out, " %p", sorted[i]->stack[k]);
+        }
+        fprintf(out, "\n");
+        i = j;
+    }
+    fprintf(out, "\nMAPPED_LIBRARIES:\n");
+    fflush(out);
+    copyMaps(out);
+
+    if (sorted) {
+        munmap(sorted, sortedSize);
+    }
+    return fclose(out);
+}
+
+int my_alloc_profile_dump(const char *path) {
+    lockAlloc();
+    int result = writeProfile(path);
+    unlockAlloc();
+    return result;
+}
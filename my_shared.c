@@ -0,0 +1,254 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "my_alloc_internal.h"
+
+// Process-shared heap.
+// A my_heap whose lists, counters and pages all live in a memfd mapping. Every process maps it at the same fixed
+// address, so the list heads and links are valid in all of them, and so are the pointers to objects. The region is sized
+// once, pages are handed out from its start and never given back.
+// The lock is a robust process-shared mutex in the mapping. A process that dies holding it may have left a list or a
+// page half changed, so the next one to take it checks the boundary tags of all pages and builds the lists and counters
+// anew from them. If the tags don't add up, the mutex is left unrecoverable and the heap fails in every process.
+
+// Starts a window of its own for pointerBase, apart from the one of the process's other blocks
+#define SHARED_BASE ((void *) 0x180000000000)
+// The free list links can't address more than 4 GiB
+#define SHARED_MAX ((size_t) 1 << 32)
+
+#define SHARED_MAGIC 0x3244455241485341ULL  // "ASHARED2"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+typedef struct sharedHeap {
+    uint64_t magic;
+    uint64_t size;  // Of the memfd
+    uint64_t top;  // Offset of the next page to hand out
+    pthread_mutex_t lock;
+    my_heap heap;
+    struct my_alloc_stats stats;
+} sharedHeap;
+
+// Pages start at the first block after the header
+#define FIRST_PAGE ((sizeof(sharedHeap) + BLOCKSIZE - 1) / BLOCKSIZE * BLOCKSIZE)
+
+// Descriptor of the shared heap mapped in this process, -1 if there is none
+static int sharedFd = -1;
+
+// Of the process, while a shared heap is entered
+static uintptr_t processBase;
+static struct my_alloc_stats *processStats;
+
+// Whether the boundary tags of a page describe objects that fill it, as the allocator leaves them between two calls
+static int tagsAddUp(page *p) {
+    void *object = p + sizeof(header);
+    void *end = p + BLOCKSIZE;
+    if (headerOf(object)->precedingObjectSize != START_OF_PAGE) {
+        return 0;
+    }
+    for (uint32_t tag; (tag = headerOf(object)->tailingObjectSize) != END_OF_PAGE;) {
+        if (!realSize(tag) || object + realSize(tag) + sizeof(header) > end) {
+            return 0;
+        }
+        uint32_t footer = footerOf(object)->precedingObjectSize;
+        if (realSize(footer) != realSize(tag) || (footer & 1) != (tag & 1)) {
+            return 0;
+        }
+        object += realSize(tag) + sizeof(header);
+    }
+    return object == end;
+}
+
+/**
+ * Builds the lists and the counters of the free spaces and live bytes anew from the boundary tags of the pages, after
+ * a process died holding the lock. Free spaces next to each other, left by a free that did not get to merge them, are
+ * merged. Runs entered, on the lists of the heap. Returns -1 if a page can't be made sense of.
+ */
+static int recoverShared(sharedHeap *s) {
+    for (uint64_t offset = FIRST_PAGE; offset < s->top; offset += BLOCKSIZE) {
+        page *p = (void *) s + offset;
+        if (headerOf(p + sizeof(header))->tailingObjectSize == END_OF_PAGE) {
+            // Taken from the region, but not formatted yet
+            formatPage(p);
+        } else if (!tagsAddUp(p)) {
+            return -1;
+        }
+    }
+
+    s->heap.lists = (struct freeLists) {0};
+    memset(s->stats.freeSpaces, 0, sizeof(s->stats.freeSpaces));
+    s->stats.emptyPages = 0;
+    s->stats.liveBytes = 0;
+    for (uint64_t offset = FIRST_PAGE; offset < s->top; offset += BLOCKSIZE) {
+        void *object = (void *) s + offset + sizeof(header);
+        for (uint32_t tag; (tag = headerOf(object)->tailingObjectSize) != END_OF_PAGE;) {
+            if (tag & 1) {
+                for (uint32_t next; (next = footerOf(object)->tailingObjectSize) & 1;) {
+                    tag = (uint32_t) (realSize(tag) + sizeof(header) + realSize(next)) | (tag & POOL_BITS) | 1;
+                    headerOf(object)->tailingObjectSize = tag;
+                    footerOf(object)->precedingObjectSize = realSize(tag) | 1;
+                }
+                insertFreeSpace(object);
+            } else {
+                s->stats.liveBytes += realSize(tag);
+            }
+            object += realSize(tag) + sizeof(header);
+        }
+    }
+    return 0;
+}
+
+int enterShared(sharedHeap *s) {
+    int r = pthread_mutex_lock(&s->lock);
+    if (r != 0 && r != EOWNERDEAD) {
+        errno = r;
+        return -1;
+    }
+    processBase = pointerBase;
+    pointerBase = (uintptr_t) SHARED_BASE;
+    processStats = allocStats;
+    allocStats = &s->stats;
+    if (r == EOWNERDEAD) {
+        if (recoverShared(s) < 0) {
+            // Unlocked without being made consistent, every lock from now on fails with ENOTRECOVERABLE
+            leaveShared(s);
+            errno = ENOTRECOVERABLE;
+            return -1;
+        }
+        pthread_mutex_consistent(&s->lock);
+    }
+    return 0;
+}
+
+void leaveShared(sharedHeap *s) {
+    pointerBase = processBase;
+    allocStats = processStats;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void *sharedPage(sharedHeap *s) {
+    if (s->top + BLOCKSIZE > s->size) {
+        return 0;
+    }
+    page *p = (void *) s + s->top;
+    s->top += BLOCKSIZE;
+    allocStats->blocksTaken++;
+    allocStats->newPages++;
+    TRACE(NEW_PAGE, p, BLOCKSIZE, 0, 0);
+    formatPage(p);
+    return p;
+}
+
+static sharedHeap *mapShared(int fd, size_t size) {
+    void *got = mmap(SHARED_BASE, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    if (got != SHARED_BASE) {
+        if (got != MAP_FAILED) {
+            munmap(got, size);
+        }
+        errno = EADDRINUSE;
+        return 0;
+    }
+    return got;
+}
+
+my_heap *my_heap_shared_create(size_t size) {
+    size = size / BLOCKSIZE * BLOCKSIZE;
+    if (sharedFd >= 0) {
+        errno = EBUSY;
+        return 0;
+    }
+    if (size <= FIRST_PAGE || size > SHARED_MAX) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    int fd = memfd_create("my_alloc", 0);
+    if (fd < 0) {
+        return 0;
+    }
+    sharedHeap *s = 0;
+    if (ftruncate(fd, (off_t) size) < 0 || !(s = mapShared(fd, size))) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return 0;
+    }
+
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attributes, PTHREAD_MUTEX_ROBUST);
+    int r = pthread_mutex_init(&s->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+    if (r != 0) {
+        munmap(s, size);
+        close(fd);
+        errno = r;
+        return 0;
+    }
+
+    // The memfd is zero filled, only what is not 0 needs to be set
+    s->size = size;
+    s->top = FIRST_PAGE;
+    s->heap.shared = s;
+    s->stats.magic = MY_ALLOC_STATS_MAGIC;
+    s->stats.blockSize = BLOCKSIZE;
+    s->stats.pools = NUMBER_OF_POOLS;
+    s->stats.lists = NUMBER_OF_LISTS;
+    s->stats.pid = getpid();
+    __atomic_store_n(&s->magic, SHARED_MAGIC, __ATOMIC_RELEASE);
+    sharedFd = fd;
+    return &s->heap;
+}
+
+my_heap *my_heap_shared_attach(int fd) {
+    if (sharedFd >= 0) {
+        errno = EBUSY;
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        return 0;
+    }
+    if ((size_t) st.st_size <= FIRST_PAGE || (size_t) st.st_size > SHARED_MAX) {
+        errno = EINVAL;
+        return 0;
+    }
+    sharedHeap *s = mapShared(fd, st.st_size);
+    if (!s) {
+        return 0;
+    }
+    if (__atomic_load_n(&s->magic, __ATOMIC_ACQUIRE) != SHARED_MAGIC || s->size != (uint64_t) st.st_size) {
+        munmap(s, st.st_size);
+        errno = EINVAL;
+        return 0;
+    }
+    sharedFd = fd;
+    return &s->heap;
+}
+
+int my_heap_shared_fd(my_heap *heap) {
+    return heap->shared ? sharedFd : -1;
+}
+
+void detachShared(sharedHeap *s) {
+    munmap(s, s->size);
+    close(sharedFd);
+    sharedFd = -1;
+}
+
+size_t my_heap_offset(my_heap *heap, void *ptr) {
+    return (uintptr_t) ptr - (uintptr_t) heap;
+}
+
+void *my_heap_pointer(my_heap *heap, size_t offset) {
+    return (void *) heap + offset;
+}
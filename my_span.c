@@ -0,0 +1,256 @@
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "my_alloc_internal.h"
+
+// Spans for objects that do not fit into a page.
+// get_block_from_system hands out blocks that need not be next to each other, so spans are carved from runs of
+// adjacent blocks that get_blocks_from_system hands out at once. Every span is a part of a run starting with a header
+// that holds its length and the length of the span before it, like the boundary tags of the objects in a page.
+// Free spans coalesce with their neighbours in the same run and are kept in bins by length. The frame map marks the
+// blocks of runs with FRAME_SPAN.
+// Empty pages never become spans, nothing tells whether the blocks next to a page belong to the allocator. Under a
+// budget they are given back to make room for a new run instead. Runs without any span in use go the other way, to
+// the empty pages, when the pages run out of memory.
+
+// Blocks taken at least for a new run
+#define SPAN_GROW 64
+// Free spans are given back to the system once this many blocks were freed since the last time
+#define SPAN_PURGE 4096
+
+#define SPAN_FREE 1
+// Free span whose blocks after the first may still hold memory
+#define SPAN_DIRTY 4
+// Last span of its run
+#define SPAN_LAST 8
+
+typedef struct span {
+    uint32_t blocks;
+    uint32_t precedingBlocks;  // 0: first span of the run
+    uint32_t flags;  // SPAN_FREE, SAMPLED, SPAN_DIRTY, SPAN_LAST
+    uint32_t unused;
+    // Free spans only, the object starts here otherwise
+    struct span *next;
+    struct span *prev;
+} span;
+
+#define SPAN_HEADER offsetof(span, next)
+#define SPAN_MAX_BLOCKS ((SPAN_MAX_SIZE + SPAN_HEADER + BLOCKSIZE - 1) / BLOCKSIZE)
+// Bin n holds the free spans of n blocks, the last one all longer spans, any of which fits every object
+#define SPAN_BINS ((int) SPAN_MAX_BLOCKS + 2)
+#define BIN_WORDS ((SPAN_BINS + 63) / 64)
+
+int spans = 1;
+
+static span *bins[SPAN_BINS];
+static uint64_t nonEmptyBins[BIN_WORDS];
+static size_t dirtyBlocks = 0;
+
+static int binOf(uint32_t blocks) {
+    return blocks < (uint32_t) SPAN_BINS - 1 ? (int) blocks : SPAN_BINS - 1;
+}
+
+static span *following(span *s) {
+    return s->flags & SPAN_LAST ? 0 : (void *) s + (size_t) s->blocks * BLOCKSIZE;
+}
+
+static span *preceding(span *s) {
+    return s->precedingBlocks ? (void *) s - (size_t) s->precedingBlocks * BLOCKSIZE : 0;
+}
+
+static void insertSpan(span *s, uint32_t dirty) {
+    int bin = binOf(s->blocks);
+    s->flags = SPAN_FREE | dirty | (s->flags & SPAN_LAST);
+    s->prev = 0;
+    s->next = bins[bin];
+    if (s->next) {
+        s->next->prev = s;
+    }
+    bins[bin] = s;
+    nonEmptyBins[bin / 64] |= (uint64_t) 1 << (bin % 64);
+    allocStats->freeSpanBlocks += s->blocks;
+}
+
+static void removeSpan(span *s) {
+    int bin = binOf(s->blocks);
+    if (s->prev) {
+        s->prev->next = s->next;
+    } else {
+        bins[bin] = s->next;
+        if (!s->next) {
+            nonEmptyBins[bin / 64] &= ~((uint64_t) 1 << (bin % 64));
+        }
+    }
+    if (s->next) {
+        s->next->prev = s->prev;
+    }
+    allocStats->freeSpanBlocks -= s->blocks;
+}
+
+// Smallest free span of at least blocks, taken out of its bin
+static span *takeSpan(uint32_t blocks) {
+    for (int bin = binOf(blocks); bin < SPAN_BINS; bin = (bin | 63) + 1) {
+        uint64_t candidates = nonEmptyBins[bin / 64] & ~(((uint64_t) 1 << (bin % 64)) - 1);
+        if (candidates) {
+            span *s = bins[bin / 64 * 64 + __builtin_ctzll(candidates)];
+            removeSpan(s);
+            return s;
+        }
+    }
+    return 0;
+}
+
+static void setFrames(void *run, uint32_t blocks, uint32_t kind) {
+    for (uint32_t i = 0; i < blocks * FRAMES_PER_BLOCK; ++i) {
+        *frameOf(run + ((size_t) i << FRAME_SHIFT)) = kind;
+    }
+}
+
+// Takes a new run from the system. Returns a free span of at least blocks covering it, which is not in a bin.
+// Within the budget, empty pages are given back to make room for it.
+static span *grow(uint32_t blocks) {
+    uint32_t add = blocks > SPAN_GROW ? blocks : SPAN_GROW;
+    if (budget) {
+        size_t limit = budget / BLOCKSIZE;
+        if (blocksTaken + blocks > limit) {
+            releaseEmptyPages(blocksTaken + blocks - limit);
+        }
+        if (blocksTaken + add > limit) {
+            add = blocks;
+            if (blocksTaken + add > limit) {
+                return 0;
+            }
+        }
+    }
+    span *s = get_blocks_from_system(add);
+    if (!s || !inLinkWindow(s, (size_t) add * BLOCKSIZE)) {
+        // Out of memory, or the frame map can't mark the run. It stays with the system then.
+        return 0;
+    }
+    blocksTaken += add;
+    allocStats->blocksTaken = blocksTaken;
+    allocStats->systemBlocks = get_sys_blockcount();
+    allocStats->spanBlocks += add;
+    setFrames(s, add, FRAME_SPAN);
+
+    s->blocks = add;
+    s->precedingBlocks = 0;
+    s->flags = SPAN_FREE | SPAN_LAST;
+    TRACE(NEW_PAGE, s, (size_t) add * BLOCKSIZE, MY_TRACE_SPAN, 0);
+    return s;
+}
+
+void *spanAlloc(size_t size) {
+    if (size > SPAN_MAX_SIZE) {
+        return 0;
+    }
+    uint32_t blocks = (uint32_t) ((size + SPAN_HEADER + BLOCKSIZE - 1) / BLOCKSIZE);
+    span *s;
+    // Out of budget, the same way as for objects on pages
+    while (!(s = takeSpan(blocks)) && !(s = grow(blocks))) {
+        if (!makeRoom(size)) {
+            return 0;
+        }
+    }
+
+    if (s->blocks > blocks) {
+        // Split, the rest stays free
+        span *rest = (void *) s + (size_t) blocks * BLOCKSIZE;
+        rest->blocks = s->blocks - blocks;
+        rest->precedingBlocks = blocks;
+        rest->flags = s->flags & SPAN_LAST;
+        span *next = following(s);
+        if (next) {
+            next->precedingBlocks = rest->blocks;
+        }
+        s->flags &= ~SPAN_LAST;
+        s->blocks = blocks;
+        insertSpan(rest, s->flags & SPAN_DIRTY);
+        TRACE(SPLIT, rest, (size_t) rest->blocks * BLOCKSIZE, MY_TRACE_SPAN, binOf(rest->blocks));
+    }
+    s->flags &= SPAN_LAST;
+    allocStats->liveBytes += (size_t) blocks * BLOCKSIZE - SPAN_HEADER;
+    TRACE(ALLOC, (void *) s + SPAN_HEADER, (size_t) blocks * BLOCKSIZE - SPAN_HEADER, MY_TRACE_SPAN, blocks);
+    return (void *) s + SPAN_HEADER;
+}
+
+// Gives the memory of all dirty free spans back to the system, except the blocks with their headers.
+// Done in batches, releasing every freed object right away costs a system call and page faults for each reuse.
+static void purge() {
+    for (int bin = 1; bin < SPAN_BINS; ++bin) {
+        for (span *s = bins[bin]; s; s = s->next) {
+            if (s->flags & SPAN_DIRTY && s->blocks > 1) {
+                madvise((void *) s + BLOCKSIZE, (size_t) (s->blocks - 1) * BLOCKSIZE, MADV_DONTNEED);
+            }
+            s->flags &= ~SPAN_DIRTY;
+        }
+    }
+    dirtyBlocks = 0;
+}
+
+void spanFree(void *ptr) {
+    span *s = ptr - SPAN_HEADER;
+    allocStats->liveBytes -= (size_t) s->blocks * BLOCKSIZE - SPAN_HEADER;
+    dirtyBlocks += s->blocks;
+    TRACE(FREE, ptr, (size_t) s->blocks * BLOCKSIZE - SPAN_HEADER, MY_TRACE_SPAN, s->blocks);
+    int merged = 0;
+
+    span *next = following(s);
+    if (next && next->flags & SPAN_FREE) {
+        removeSpan(next);
+        s->blocks += next->blocks;
+        s->flags |= next->flags & SPAN_LAST;
+        merged |= 1;
+    }
+    span *prev = preceding(s);
+    if (prev && prev->flags & SPAN_FREE) {
+        removeSpan(prev);
+        prev->blocks += s->blocks;
+        prev->flags |= s->flags & SPAN_LAST;
+        s = prev;
+        merged |= 2;
+    }
+    next = following(s);
+    if (next) {
+        next->precedingBlocks = s->blocks;
+    }
+    if (merged) {
+        TRACE(COALESCE, s, (size_t) s->blocks * BLOCKSIZE, MY_TRACE_SPAN, merged);
+    }
+    insertSpan(s, SPAN_DIRTY);
+    if (dirtyBlocks >= SPAN_PURGE) {
+        purge();
+    }
+}
+
+size_t releaseSpanRuns() {
+    size_t released = 0;
+    for (int bin = 1; bin < SPAN_BINS; ++bin) {
+        span *s = bins[bin];
+        while (s) {
+            span *next = s->next;
+            if (!s->precedingBlocks && s->flags & SPAN_LAST) {
+                removeSpan(s);
+                uint32_t blocks = s->blocks;
+                setFrames(s, blocks, 0);
+                for (uint32_t i = 0; i < blocks; ++i) {
+                    void *block = (void *) s + (size_t) i * BLOCKSIZE;
+                    formatPage(block);
+                    insertFreeSpace(block + sizeof(header));
+                }
+                allocStats->spanBlocks -= blocks;
+                released += blocks;
+            }
+            s = next;
+        }
+    }
+    return released;
+}
+
+void spanMarkSampled(void *ptr) {
+    ((span *) (ptr - SPAN_HEADER))->flags |= SAMPLED;
+}
+
+int spanSampled(void *ptr) {
+    return (((span *) (ptr - SPAN_HEADER))->flags & SAMPLED) != 0;
+}
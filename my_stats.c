@@ -0,0 +1,53 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "my_alloc_internal.h"
+
+// Shared memory export of the counters in allocStats
+
+int my_alloc_stats_export(const char *name) {
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, sizeof(struct my_alloc_stats)) < 0) {
+        close(fd);
+        return -1;
+    }
+    struct my_alloc_stats *shared = mmap(0, sizeof(struct my_alloc_stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shared == MAP_FAILED) {
+        return -1;
+    }
+
+    lockAlloc();
+    // Carry over what has been counted so far
+    *shared = *allocStats;
+    shared->pid = getpid();
+    struct my_alloc_stats *previous = allocStats;
+    allocStats = shared;
+    unlockAlloc();
+
+    if (previous->pid) {
+        // Exported before
+        munmap(previous, sizeof(struct my_alloc_stats));
+    }
+    return 0;
+}
+
+void countFreeSpaces() {
+    for (int pool = 0; pool < NUMBER_OF_POOLS; ++pool) {
+        for (int i = 0; i < NUMBER_OF_LISTS; ++i) {
+            allocStats->freeSpaces[pool][i] = 0;
+            for (doublePointer *p = defaultLists.buckets[pool][i]; p; p = secondPointer(*p)) {
+                allocStats->freeSpaces[pool][i]++;
+            }
+        }
+    }
+    allocStats->emptyPages = 0;
+    for (doublePointer *p = defaultLists.emptyPages; p; p = secondPointer(*p)) {
+        allocStats->emptyPages++;
+    }
+}
@@ -7,12 +7,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #include "my_system.h"
 
+/* Mindestens ein Block */
+#if BLOCKSIZE > 8192
+#define SYSBLOCKSIZE BLOCKSIZE
+#else
 #define SYSBLOCKSIZE 8192
+#endif
 
 struct sysblock {
 	char * start;
+	size_t len;
 	size_t offset;
 	struct sysblock * next;
 };
@@ -24,7 +31,7 @@ static struct avl_node * blocks = NULL;
 void * get_block_from_system ()
 {
 	char * ret;
-	if (sysblocks == NULL || sysblocks->offset == SYSBLOCKSIZE) {
+	if (sysblocks == NULL || sysblocks->offset == sysblocks->len) {
 		struct sysblock * nb = malloc (sizeof (struct sysblock));
 		/* Betriebssystem hat keinen weiteren Speicher mehr. */
 		my_assert (nb, "Betriebssystem hat keinen weiteren Speicher mehr");
@@ -34,6 +41,7 @@ void * get_block_from_system ()
 			free (nb);
 			return NULL;
 		}
+		nb->len = SYSBLOCKSIZE;
 		nb->offset = 0;
 		nb->next = sysblocks;
 		sysblocks = nb;
@@ -48,11 +56,75 @@ void * get_block_from_system ()
 	return ret;
 }
 
+/* Wie get_block_from_system, aber n aneinander grenzende Bloecke auf
+ * einmal. Sie zaehlen wie n einzelne Bloecke.
+ */
+void * get_blocks_from_system (size_t n)
+{
+	struct sysblock * nb = malloc (sizeof (struct sysblock));
+	/* Betriebssystem hat keinen weiteren Speicher mehr. */
+	my_assert (nb, "Betriebssystem hat keinen weiteren Speicher mehr");
+	nb->len = n * BLOCKSIZE;
+	nb->start = mmap (0, nb->len, PROT_READ|PROT_WRITE,
+	                  MAP_PRIVATE|MAP_ANON, -1, 0);
+	if (nb->start == NULL || nb->start == MAP_FAILED) {
+		free (nb);
+		return NULL;
+	}
+	nb->offset = nb->len;
+	/* Ein angefangener Block bleibt vorne, damit er weiter benutzt wird */
+	if (sysblocks && sysblocks->offset < sysblocks->len) {
+		nb->next = sysblocks->next;
+		sysblocks->next = nb;
+	} else {
+		nb->next = sysblocks;
+		sysblocks = nb;
+	}
+	sys_blockcount += n;
+	if (blocks == NULL) {
+		blocks = create_avl ();
+	}
+	insert_avl (&blocks, (size_t)nb->start, nb->len);
+	return nb->start;
+}
+
 size_t get_sys_blockcount ()
 {
 	return sys_blockcount;
 }
 
+/* Zaehlt die Seiten aller Bloecke von get_block_from_system, die gerade
+ * im Hauptspeicher liegen. Aneinander grenzende Bloecke werden mit
+ * einem Aufruf von mincore abgefragt.
+ */
+size_t get_sys_resident_pages ()
+{
+	static unsigned char vec[256];
+	size_t pagesize = sysconf (_SC_PAGESIZE);
+	size_t resident = 0;
+	struct sysblock * sb = sysblocks;
+	while (sb) {
+		char * start = sb->start;
+		size_t len = sb->len, off, i;
+		/* Neuere Bloecke liegen meist direkt vor den aelteren */
+		while (sb->next && sb->next->start == start + len) {
+			sb = sb->next;
+			len += sb->len;
+		}
+		for (off = 0; off < len; off += sizeof (vec) * pagesize) {
+			size_t chunk = len - off;
+			if (chunk > sizeof (vec) * pagesize)
+				chunk = sizeof (vec) * pagesize;
+			if (mincore (start + off, chunk, vec) == 0) {
+				for (i = 0; i < chunk / pagesize; ++i)
+					resident += vec[i] & 1;
+			}
+		}
+		sb = sb->next;
+	}
+	return resident;
+}
+
 bool valid_area (size_t start, size_t len)
 {
 	struct avl_node * node;
@@ -4,7 +4,12 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+/* Can be set at compile time, e.g. -DBLOCKSIZE=16384: a power of two
+ * from 4096 to 65536.
+ */
+#ifndef BLOCKSIZE
 #define BLOCKSIZE	8192
+#endif
 
 /* Get a 1024-Byte aligned Block of Memory from the System. The return
  * value is 0 if no more memory is availiable. Otherwise it points to
@@ -12,6 +17,11 @@
  */
 void * get_block_from_system();
 
+/* Like get_block_from_system, but n adjacent blocks at once. They count
+ * as n blocks.
+ */
+void * get_blocks_from_system (size_t n);
+
 /*
  *
  *
@@ -47,6 +57,7 @@ void * get_block_from_system();
 
 /* Internal Functions and data structures for the tester. */
 size_t get_sys_blockcount ();
+size_t get_sys_resident_pages ();
 bool valid_area (size_t start, size_t len);
 
 struct avl_node {
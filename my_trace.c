@@ -0,0 +1,119 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "my_alloc_internal.h"
+
+// Event tracer.
+// The TRACE points in the allocator append fixed size records to a ring buffer in a shared file mapping, so the
+// records survive a crash and mytrace can read them while the process runs. A record costs a few stores and reading
+// the TSC, so tracing hardly changes the timing it is meant to show. Without tracing each point is a load and a branch.
+
+#define DEFAULT_RECORDS (1 << 20)
+#define MAX_RECORDS ((size_t) 1 << 31)
+
+struct my_alloc_trace_header *traceHeader = 0;
+
+static struct my_alloc_trace_record *traceRecords = 0;
+static size_t mappedSize = 0;
+
+static uint64_t traceClock() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+#endif
+}
+
+void traceEvent(int event, void *address, size_t size, int pool, int bucket) {
+    uint64_t n = traceHeader->written;
+    struct my_alloc_trace_record *r = &traceRecords[n & (traceHeader->capacity - 1)];
+    r->tsc = traceClock();
+    r->address = (uintptr_t) address;
+    r->size = (uint32_t) size;
+    r->event = (uint8_t) event;
+    r->pool = (uint8_t) pool;
+    r->bucket = (uint16_t) bucket;
+    // Readers take written as the end of valid records
+    __atomic_store_n(&traceHeader->written, n + 1, __ATOMIC_RELEASE);
+}
+
+static uint64_t monotonicNs() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+int my_alloc_trace_start(const char *path, size_t records) {
+#ifdef MY_ALLOC_NO_TRACE
+    (void) path;
+    (void) records;
+    errno = ENOSYS;
+    return -1;
+#else
+    if (records == 0) {
+        records = DEFAULT_RECORDS;
+    }
+    if (records > MAX_RECORDS) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t capacity = 1;
+    while (capacity < records) {
+        capacity *= 2;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    size_t size = sizeof(struct my_alloc_trace_header) + capacity * sizeof(struct my_alloc_trace_record);
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return -1;
+    }
+    struct my_alloc_trace_header *h = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED) {
+        return -1;
+    }
+    h->recordSize = sizeof(struct my_alloc_trace_record);
+    h->capacity = (uint32_t) capacity;
+    h->pid = getpid();
+#if !defined(__x86_64__) && !defined(__i386__)
+    h->tscIsNs = 1;
+#endif
+    h->startNs = monotonicNs();
+    h->startTsc = traceClock();
+    // Last, a reader takes the file for a trace once the magic is there
+    __atomic_store_n(&h->magic, MY_ALLOC_TRACE_MAGIC, __ATOMIC_RELEASE);
+
+    my_alloc_trace_stop();
+    lockAlloc();
+    traceRecords = (struct my_alloc_trace_record *) (h + 1);
+    traceHeader = h;
+    mappedSize = size;
+    unlockAlloc();
+    return 0;
+#endif
+}
+
+void my_alloc_trace_stop() {
+    lockAlloc();
+    struct my_alloc_trace_header *h = traceHeader;
+    traceHeader = 0;
+    traceRecords = 0;
+    unlockAlloc();
+    if (h) {
+        h->stopTsc = traceClock();
+        h->stopNs = monotonicNs();
+        munmap(h, mappedSize);
+    }
+}
@@ -0,0 +1,253 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "my_system.h"
+
+// Generates the size class table of the free lists (my_size_classes.h) from a histogram of allocation sizes, e.g.
+// the output of mytrace -s. Objects are placed at their exact size, the classes only decide which list a free space
+// goes to. A request whose size starts a list takes any space of that list, all others need a space from a list
+// further up or a walk through their own list. So the lists should start at the sizes requested most, and the
+// rounding of each request up to the next start (the slack of the space it is guaranteed to get) stays small.
+// Without a histogram, writes the default table: exact lists up to 248 bytes, then four lists per power of two.
+// Built with another BLOCKSIZE, e.g. -DBLOCKSIZE=16384, it writes tables for that block size.
+
+// Free space of a whole page, the largest size in the table
+#define LIMIT (BLOCKSIZE - 16)
+// Sizes are multiples of 8, size 8 * k is at index k
+#define SIZES (LIMIT / 8)
+// nonEmptyBuckets is a 64 bit mask
+#define MAX_LISTS 64
+
+static double count[SIZES + 2];
+
+static int readHistogram(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    char line[256];
+    int lineNumber = 0;
+    double skipped = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineNumber++;
+        unsigned long size;
+        double n;
+        char *start = line + strspn(line, " \t");
+        if (*start == '#' || *start == '\n' || *start == 0) {
+            continue;
+        }
+        if (sscanf(start, "%lu %lf", &size, &n) != 2 || n < 0) {
+            fprintf(stderr, "%s:%d: expected \"size count\"\n", path, lineNumber);
+            fclose(f);
+            return -1;
+        }
+        if (size == 0 || size > LIMIT) {
+            // Bitmap and span objects are not in the lists
+            skipped += n;
+            continue;
+        }
+        count[(size + 7) / 8] += n;
+    }
+    fclose(f);
+    if (skipped > 0) {
+        fprintf(stderr, "%.0f allocations of sizes outside the free lists ignored\n", skipped);
+    }
+    return 0;
+}
+
+// Exact lists below 256 bytes, perRange lists per power of two above. Returns the number of lists, -1 if too many.
+static int defaultStarts(uint32_t *starts, int perRange) {
+    int n = 0;
+    for (uint32_t size = 8; size < 256; size += 8) {
+        starts[n++] = size;
+    }
+    for (uint32_t range = 256; range < LIMIT; range *= 2) {
+        for (uint32_t size = range; size < 2 * range && size <= LIMIT; size += range / perRange) {
+            if (n == MAX_LISTS) {
+                return -1;
+            }
+            starts[n++] = size;
+        }
+    }
+    return n;
+}
+
+// Prefix sums over count and 8 * k * count, for the rounding slack of any range of sizes
+static double countSum[SIZES + 2];
+static double bytesSum[SIZES + 2];
+
+// Slack of the requests of sizes (a, b] rounded up to b, as indices
+static double slack(int a, int b) {
+    return 8.0 * b * (countSum[b] - countSum[a]) - (bytesSum[b] - bytesSum[a]);
+}
+
+// Best slack with m lists, the last one starting at j, and where it came from
+static double best[MAX_LISTS + 1][SIZES + 1];
+static uint16_t from[MAX_LISTS + 1][SIZES + 1];
+
+/**
+ * Chooses list starts by dynamic programming: the fewest lists up to maxLists whose slack is at most target of the
+ * requested bytes, the least slack for that number. Requests above the last start round up to a whole page.
+ * @return Number of lists
+ */
+static int optimizedStarts(uint32_t *starts, int maxLists, double target, double *fragmentation) {
+    for (int k = 1; k <= SIZES + 1; ++k) {
+        countSum[k] = countSum[k - 1] + count[k];
+        bytesSum[k] = bytesSum[k - 1] + 8.0 * k * count[k];
+    }
+    double requested = bytesSum[SIZES + 1];
+
+    // The first list starts at 8, size 8 has no slack
+    for (int j = 1; j <= SIZES; ++j) {
+        best[1][j] = j == 1 ? 0 : -1;
+    }
+    int lists = 0;
+    int last = 1;
+    double total = slack(1, SIZES + 1);
+    for (int m = 1; m <= maxLists; ++m) {
+        if (m > 1) {
+            for (int j = 1; j <= SIZES; ++j) {
+                best[m][j] = -1;
+                for (int i = 1; i < j; ++i) {
+                    if (best[m - 1][i] >= 0) {
+                        double s = best[m - 1][i] + slack(i, j);
+                        if (best[m][j] < 0 || s < best[m][j]) {
+                            best[m][j] = s;
+                            from[m][j] = (uint16_t) i;
+                        }
+                    }
+                }
+            }
+        }
+        lists = m;
+        total = -1;
+        for (int j = 1; j <= SIZES; ++j) {
+            if (best[m][j] >= 0 && (total < 0 || best[m][j] + slack(j, SIZES + 1) < total)) {
+                total = best[m][j] + slack(j, SIZES + 1);
+                last = j;
+            }
+        }
+        if (total <= target * requested) {
+            break;
+        }
+    }
+
+    for (int m = lists, j = last; m > 0; j = from[m][j], --m) {
+        starts[m - 1] = 8 * j;
+    }
+    *fragmentation = total / requested;
+    return lists;
+}
+
+// FNV-1a of the starts and the limit, for files that store lists to tell tables (and block sizes) apart
+static uint64_t tableId(const uint32_t *starts, int n) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (int i = 0; i <= n; ++i) {
+        h = (h ^ (i < n ? starts[i] : LIMIT + 8)) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+static void writeTable(const uint32_t *starts, int n, const char *source) {
+    uint64_t exact = 0;
+    for (int i = 0; i < n; ++i) {
+        if ((i + 1 < n ? starts[i + 1] : LIMIT + 8) == starts[i] + 8) {
+            exact |= (uint64_t) 1 << i;
+        }
+    }
+
+    printf("// Size classes of the free lists, generated by mysizes from %s.\n", source);
+    printf("// Regenerate it with mysizes instead of editing.\n\n");
+    printf("#ifndef MY_SIZE_CLASSES_H\n#define MY_SIZE_CLASSES_H\n\n#include <stdint.h>\n\n");
+    printf("// Largest size in the table, the free space of a whole page\n#define SIZE_CLASS_LIMIT %d\n", LIMIT);
+    printf("#define NUMBER_OF_LISTS %d\n", n);
+    printf("// Lists whose free spaces all have the same size\n#define EXACT_LISTS 0x%016llxull\n",
+           (unsigned long long) exact);
+    printf("// Tells tables apart in files that store lists\n#define SIZE_CLASSES_ID 0x%016llxull\n\n",
+           (unsigned long long) tableId(starts, n));
+
+    printf("// List i holds the free spaces of sizes [sizeClassStart[i], sizeClassStart[i + 1])\n");
+    printf("static const uint32_t sizeClassStart[NUMBER_OF_LISTS + 1] = {");
+    for (int i = 0; i <= n; ++i) {
+        printf("%s%u,", i % 12 ? " " : "\n        ", i < n ? starts[i] : LIMIT + 8);
+    }
+    printf("\n};\n\n");
+
+    printf("// List of the free spaces of size 8 * (n + 1)\n");
+    printf("static const uint8_t sizeClassOf[SIZE_CLASS_LIMIT / 8] = {");
+    for (int k = 1, list = 0; k <= SIZES; ++k) {
+        while (list + 1 < n && starts[list + 1] <= 8u * k) {
+            list++;
+        }
+        printf("%s%d,", (k - 1) % 24 ? " " : "\n        ", list);
+    }
+    printf("\n};\n\n#endif\n");
+}
+
+int main(int argc, char **argv) {
+    int maxLists = MAX_LISTS;
+    double target = 1;
+    int perRange = 4;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:f:p:")) != -1) {
+        if (opt == 'n' && atoi(optarg) > 0 && atoi(optarg) <= MAX_LISTS) {
+            maxLists = atoi(optarg);
+        } else if (opt == 'f' && atof(optarg) >= 0) {
+            target = atof(optarg);
+        } else if (opt == 'p' && (atoi(optarg) == 1 || atoi(optarg) == 2 || atoi(optarg) == 4 || atoi(optarg) == 8)) {
+            perRange = atoi(optarg);
+        } else {
+            optind = argc + 1;
+        }
+    }
+    if (optind < argc - 1 || optind > argc) {
+        fprintf(stderr, "usage: %s [-n lists] [-f percent] [-p lists] [histogram] > my_size_classes.h\n"
+                        "  histogram  lines of \"size count\", e.g. from mytrace -s, default table without\n"
+                        "  -n  at most this many lists, up to %d\n"
+                        "  -f  fewest lists that round requests up by at most this share of the requested bytes,\n"
+                        "      default 1\n"
+                        "  -p  default table: lists per power of two from 256 bytes on, 1, 2, 4 (default) or 8\n",
+                argv[0], MAX_LISTS);
+        return 1;
+    }
+
+    uint32_t starts[MAX_LISTS];
+    int n;
+    if (optind == argc) {
+        n = defaultStarts(starts, perRange);
+        if (n < 0) {
+            fprintf(stderr, "more than %d lists with %d per power of two up to %d bytes\n", MAX_LISTS, perRange,
+                    LIMIT);
+            return 1;
+        }
+        char source[100];
+        snprintf(source, sizeof(source), "no histogram (default, %d lists per power of two)", perRange);
+        writeTable(starts, n, perRange == 4 ? "no histogram (default)" : source);
+        return 0;
+    }
+
+    if (readHistogram(argv[optind]) < 0) {
+        return 1;
+    }
+    double requests = 0;
+    for (int k = 1; k <= SIZES; ++k) {
+        requests += count[k];
+    }
+    if (requests == 0) {
+        fprintf(stderr, "%s: no allocations\n", argv[optind]);
+        return 1;
+    }
+    double fragmentation;
+    n = optimizedStarts(starts, maxLists, target / 100, &fragmentation);
+    fprintf(stderr, "%d lists, requests round up by %.2f%% of %.0f allocations' bytes\n", n, 100 * fragmentation,
+            requests);
+    char source[300];
+    snprintf(source, sizeof(source), "%.200s (%d lists, %.2f%% slack)", argv[optind], n, 100 * fragmentation);
+    writeTable(starts, n, source);
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "my_alloc.h"
+
+// Reads the counters a process published with my_alloc_stats_export, once or every few seconds.
+
+static uint64_t read64(const void *counter) {
+    return __atomic_load_n((const uint64_t *) counter, __ATOMIC_RELAXED);
+}
+
+static const char *sizeOfList(int list, char *buffer, size_t length) {
+    if (sizeClassStart[list + 1] == sizeClassStart[list] + 8) {
+        snprintf(buffer, length, "%u", sizeClassStart[list]);
+    } else {
+        snprintf(buffer, length, "%u-%u", sizeClassStart[list], sizeClassStart[list + 1] - 8);
+    }
+    return buffer;
+}
+
+static void print(const struct my_alloc_stats *stats, const struct my_alloc_stats *last, int interval) {
+    uint64_t blocks = read64(&stats->blocksTaken);
+    uint64_t live = read64(&stats->liveBytes);
+    uint64_t objects = read64(&stats->allocations) - read64(&stats->frees);
+    int32_t pid = __atomic_load_n(&stats->pid, __ATOMIC_RELAXED);
+    printf("pid %d%s\n", pid, kill(pid, 0) == 0 ? "" : " (not running)");
+    printf("  blocks     %10lu taken, %lu from the system, %lu empty, %lu bitmap\n", (unsigned long) blocks,
+           (unsigned long) read64(&stats->systemBlocks), (unsigned long) read64(&stats->emptyPages),
+           (unsigned long) read64(&stats->bitmapPages));
+    printf("  live       %10lu bytes in %lu objects, %.1f%% of the blocks\n", (unsigned long) live,
+           (unsigned long) objects, blocks ? 100.0 * live / (blocks * stats->blockSize) : 0);
+    printf("  new pages  %10lu", (unsigned long) read64(&stats->newPages));
+    if (last) {
+        printf(", %+ld in %d s", (long) (read64(&stats->newPages) - last->newPages), interval);
+    }
+    printf("\n  failed     %10lu allocations\n", (unsigned long) read64(&stats->failedAllocations));
+    printf("  spans      %10lu blocks, %lu free\n", (unsigned long) read64(&stats->spanBlocks),
+           (unsigned long) read64(&stats->freeSpanBlocks));
+    printf("  deferred   %10lu objects waiting for readers\n", (unsigned long) read64(&stats->deferredObjects));
+
+    printf("  free spaces by pool and size\n");
+    char size[32];
+    for (int pool = 0; pool < NUMBER_OF_POOLS; ++pool) {
+        for (int i = 0; i < NUMBER_OF_LISTS; ++i) {
+            int64_t count = (int64_t) read64(&stats->freeSpaces[pool][i]);
+            if (count) {
+                printf("    %d %12s %10ld\n", pool, sizeOfList(i, size, sizeof(size)), (long) count);
+            }
+        }
+    }
+}
+
+// Copies the counters that are compared between intervals
+static void remember(const struct my_alloc_stats *stats, struct my_alloc_stats *last) {
+    last->newPages = read64(&stats->newPages);
+}
+
+int main(int argc, char **argv) {
+    int interval = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:")) != -1) {
+        if (opt == 'i' && atoi(optarg) > 0) {
+            interval = atoi(optarg);
+        } else {
+            optind = argc + 1;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-i seconds] name\n", argv[0]);
+        return 1;
+    }
+
+    int fd = shm_open(argv[optind], O_RDONLY, 0);
+    if (fd < 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    const struct my_alloc_stats *stats = mmap(0, sizeof(struct my_alloc_stats), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (stats == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    if (stats->magic != MY_ALLOC_STATS_MAGIC || stats->pools != NUMBER_OF_POOLS ||
+        stats->lists != NUMBER_OF_LISTS) {
+        fprintf(stderr, "%s: not a my_alloc stats segment of this version\n", argv[optind]);
+        return 1;
+    }
+
+    struct my_alloc_stats last;
+    print(stats, 0, interval);
+    while (interval) {
+        remember(stats, &last);
+        sleep(interval);
+        printf("\n");
+        print(stats, &last, interval);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,201 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "my_alloc_trace.h"
+
+// Decodes a trace written after my_alloc_trace_start: a timeline of the records or a report aggregated over them.
+
+static const char *eventNames[MY_TRACE_EVENTS] = {
+        "?", "alloc", "free", "split", "coalesce", "insert", "remove", "new-page", "bucket-miss", "out-of-memory"};
+
+// Only the records of these events are about a free list
+#define LIST_EVENTS ((1 << MY_TRACE_INSERT) | (1 << MY_TRACE_REMOVE) | (1 << MY_TRACE_BUCKET_MISS))
+
+static double nsPerTick = 1;
+
+static uint64_t monotonicNs() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+// Converts timestamps with the clocks taken at start and stop. While the traced process still runs, the TSC of this
+// one takes the place of the stop clock, it is the same counter on machines with an invariant TSC.
+static void calibrate(const struct my_alloc_trace_header *h) {
+    if (h->tscIsNs) {
+        return;
+    }
+    uint64_t tsc = h->stopTsc;
+    uint64_t ns = h->stopNs;
+    if (!tsc) {
+#if defined(__x86_64__) || defined(__i386__)
+        ns = monotonicNs();
+        tsc = __rdtsc();
+#endif
+    }
+    if (tsc > h->startTsc && ns > h->startNs) {
+        nsPerTick = (double) (ns - h->startNs) / (tsc - h->startTsc);
+    } else {
+        fprintf(stderr, "no clock to convert timestamps, showing TSC ticks\n");
+    }
+}
+
+static const char *eventName(int event) {
+    return event > 0 && event < MY_TRACE_EVENTS ? eventNames[event] : eventNames[0];
+}
+
+static void poolName(int pool, char *buffer, size_t length) {
+    if (pool == MY_TRACE_BITMAP) {
+        snprintf(buffer, length, "bitmap");
+    } else if (pool == MY_TRACE_SPAN) {
+        snprintf(buffer, length, "span");
+    } else {
+        snprintf(buffer, length, "pool %d", pool);
+    }
+}
+
+static void timeline(const struct my_alloc_trace_record *records, uint64_t first, uint64_t end, uint32_t capacity,
+                     uint64_t startTsc) {
+    printf("%14s  %-13s %18s %10s  %-8s %s\n", "us", "event", "address", "size", "pool", "bucket");
+    char pool[16];
+    for (uint64_t n = first; n < end; ++n) {
+        const struct my_alloc_trace_record *r = &records[n & (capacity - 1)];
+        poolName(r->pool, pool, sizeof(pool));
+        printf("%14.3f  %-13s %#18lx %10u  %-8s %u\n", (double) (int64_t) (r->tsc - startTsc) * nsPerTick / 1000,
+               eventName(r->event), (unsigned long) r->address, r->size, pool, r->bucket);
+    }
+}
+
+static void report(const struct my_alloc_trace_record *records, uint64_t first, uint64_t end, uint32_t capacity) {
+    uint64_t count[MY_TRACE_EVENTS] = {0};
+    uint64_t bytes[MY_TRACE_EVENTS] = {0};
+    // Free list events by pool and list, NUMBER_OF_LISTS is emptyPages
+    static uint64_t lists[NUMBER_OF_POOLS][NUMBER_OF_LISTS + 1][MY_TRACE_EVENTS];
+    uint64_t firstTsc = records[first & (capacity - 1)].tsc;
+    uint64_t lastTsc = firstTsc;
+
+    for (uint64_t n = first; n < end; ++n) {
+        const struct my_alloc_trace_record *r = &records[n & (capacity - 1)];
+        int event = r->event < MY_TRACE_EVENTS ? r->event : 0;
+        count[event]++;
+        bytes[event] += r->size;
+        if (1 << event & LIST_EVENTS && r->pool < NUMBER_OF_POOLS && r->bucket <= NUMBER_OF_LISTS) {
+            lists[r->pool][r->bucket][event]++;
+        }
+        lastTsc = r->tsc > lastTsc ? r->tsc : lastTsc;
+    }
+
+    double seconds = (double) (lastTsc - firstTsc) * nsPerTick / 1e9;
+    printf("%lu records over %.6f s\n\n", (unsigned long) (end - first), seconds);
+    printf("  %-14s %12s %12s %14s\n", "event", "count", "per second", "mean size");
+    for (int e = 1; e < MY_TRACE_EVENTS; ++e) {
+        if (count[e]) {
+            printf("  %-14s %12lu %12.0f %14.1f\n", eventNames[e], (unsigned long) count[e],
+                   seconds > 0 ? count[e] / seconds : 0, (double) bytes[e] / count[e]);
+        }
+    }
+
+    printf("\n  free lists %18s %12s %12s\n", "insert", "remove", "miss");
+    for (int pool = 0; pool < NUMBER_OF_POOLS; ++pool) {
+        for (int i = 0; i <= NUMBER_OF_LISTS; ++i) {
+            uint64_t *l = lists[pool][i];
+            if (l[MY_TRACE_INSERT] || l[MY_TRACE_REMOVE] || l[MY_TRACE_BUCKET_MISS]) {
+                char list[16];
+                if (i == NUMBER_OF_LISTS) {
+                    snprintf(list, sizeof(list), "empty");
+                } else {
+                    snprintf(list, sizeof(list), "%d", i);
+                }
+                printf("    %d %-8s %16lu %12lu %12lu\n", pool, list, (unsigned long) l[MY_TRACE_INSERT],
+                       (unsigned long) l[MY_TRACE_REMOVE], (unsigned long) l[MY_TRACE_BUCKET_MISS]);
+            }
+        }
+    }
+}
+
+// Allocation sizes of the objects in pages, as mysizes reads them
+static void sizes(const struct my_alloc_trace_record *records, uint64_t first, uint64_t end, uint32_t capacity) {
+    static uint64_t count[SIZE_CLASS_LIMIT / 8 + 1];
+    for (uint64_t n = first; n < end; ++n) {
+        const struct my_alloc_trace_record *r = &records[n & (capacity - 1)];
+        if (r->event == MY_TRACE_ALLOC && r->pool < NUMBER_OF_POOLS && r->size <= SIZE_CLASS_LIMIT) {
+            count[r->size / 8]++;
+        }
+    }
+    printf("# size count\n");
+    for (int k = 1; k <= SIZE_CLASS_LIMIT / 8; ++k) {
+        if (count[k]) {
+            printf("%d %lu\n", 8 * k, (unsigned long) count[k]);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int showTimeline = 0;
+    int showSizes = 0;
+    uint64_t last = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "tsn:")) != -1) {
+        if (opt == 't') {
+            showTimeline = 1;
+        } else if (opt == 's') {
+            showSizes = 1;
+        } else if (opt == 'n' && atol(optarg) > 0) {
+            last = atol(optarg);
+        } else {
+            optind = argc + 1;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-t | -s] [-n records] file\n  -t  timeline instead of the report\n"
+                        "  -s  histogram of allocation sizes for mysizes instead of the report\n"
+                        "  -n  only the last records\n", argv[0]);
+        return 1;
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror(argv[optind]);
+        return 1;
+    }
+    const struct my_alloc_trace_header *h = MAP_FAILED;
+    if ((size_t) st.st_size >= sizeof(*h)) {
+        h = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (h == MAP_FAILED || h->magic != MY_ALLOC_TRACE_MAGIC || h->recordSize != sizeof(struct my_alloc_trace_record) ||
+        sizeof(*h) + (size_t) h->capacity * h->recordSize > (size_t) st.st_size) {
+        fprintf(stderr, "%s: not a my_alloc trace of this version\n", argv[optind]);
+        return 1;
+    }
+
+    // Records that were overwritten are gone, a running process may overwrite the oldest ones while they are read
+    uint64_t end = __atomic_load_n(&h->written, __ATOMIC_ACQUIRE);
+    uint64_t first = end > h->capacity ? end - h->capacity : 0;
+    if (last && end - first > last) {
+        first = end - last;
+    }
+    if (first == end) {
+        printf("no records\n");
+        return 0;
+    }
+    calibrate(h);
+    const struct my_alloc_trace_record *records = (const struct my_alloc_trace_record *) (h + 1);
+    if (showTimeline) {
+        timeline(records, first, end, h->capacity, h->startTsc);
+    } else if (showSizes) {
+        sizes(records, first, end, h->capacity);
+    } else {
+        report(records, first, end, h->capacity);
+    }
+    return 0;
+}
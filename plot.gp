@@ -1,8 +1,9 @@
 set datafile separator ","
-set terminal pngcairo size 1000, 3000
+profiles = int(ARG3)
+set terminal pngcairo size 1000, 170 * profiles
 set logscale x 10
 if (ARG2 eq "YLOG") set logscale y 10
-set multiplot layout 18, 1
-do for [index=0:17] {
+set multiplot layout profiles, 1
+do for [index=0:profiles-1] {
     plot ARG1 i index with linespoints title columnheader(1)
-}
\ No newline at end of file
+}
@@ -1,13 +1,24 @@
 #include <assert.h>
 #include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 #include "my_alloc.h"
 #include "my_system.h"
 
+#ifdef PERF_COUNTERS
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
 #ifndef VERBOSE
 #define VERBOSE 1 /* by default we want to see results */
 #endif
@@ -16,12 +27,15 @@ struct data {
 	char * ptr;
 	size_t len;
 	char * contents;
+	int key; /* free order: the object with the smallest key dies first */
 };
 
 #define DATACOUNT 1000000
+/* Largest size a size profile may return */
+#define MAXSIZE 4096
 
 static struct data data[DATACOUNT];
-static char randdata[20000];
+static char randdata[19500+MAXSIZE];
 static size_t nptr = 0;
 
 static size_t alloc = 0;
@@ -29,14 +43,165 @@ static size_t maxalloc = 0;
 static size_t nalloc = 0;
 static size_t maxnalloc = 0;
 
+#ifdef PERF_COUNTERS
+/* Hardware performance counters around every my_alloc/my_free call.
+ * Each operation type has its own counter group that is enabled just
+ * before and disabled right after the call. A third group measures an
+ * empty enable/disable pair, which is subtracted as the cost of the
+ * measurement itself.
+ */
+#define CACHE_MISS(C) ((C) | (PERF_COUNT_HW_CACHE_OP_READ << 8) \
+		       | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+struct perf_counter {
+	char * name;
+	uint32_t type;
+	uint64_t config;
+};
+
+static struct perf_counter perf_counters[] = {
+	{ "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ "L1d-misses", PERF_TYPE_HW_CACHE, CACHE_MISS (PERF_COUNT_HW_CACHE_L1D) },
+	{ "LLC-misses", PERF_TYPE_HW_CACHE, CACHE_MISS (PERF_COUNT_HW_CACHE_LL) },
+	{ "dTLB-misses", PERF_TYPE_HW_CACHE, CACHE_MISS (PERF_COUNT_HW_CACHE_DTLB) },
+	{ "branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+#define NCOUNTERS (sizeof (perf_counters) / sizeof (perf_counters[0]))
+
+struct perf_group {
+	int leader;
+	int fd[NCOUNTERS];
+	long long ops;
+	double count[NCOUNTERS];
+};
+
+static struct perf_group perf_alloc, perf_free, perf_base;
+
+static void perf_open (struct perf_group * g)
+{
+	struct perf_event_attr attr;
+	size_t i;
+	g->leader = -1;
+	g->ops = 0;
+	for (i=0; i<NCOUNTERS; ++i) {
+		memset (&attr, 0, sizeof (attr));
+		attr.size = sizeof (attr);
+		attr.type = perf_counters[i].type;
+		attr.config = perf_counters[i].config;
+		attr.disabled = g->leader < 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+				   | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		g->fd[i] = syscall (SYS_perf_event_open, &attr, 0, -1,
+				    g->leader, 0);
+		if (g->fd[i] < 0 && g->leader < 0) {
+			perror ("perf_event_open");
+			return;
+		}
+		if (g->leader < 0)
+			g->leader = g->fd[i];
+	}
+}
+
+static inline void perf_start (struct perf_group * g)
+{
+	if (g->leader >= 0)
+		ioctl (g->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static inline void perf_stop (struct perf_group * g)
+{
+	if (g->leader >= 0)
+		ioctl (g->leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	g->ops++;
+}
+
+/* Counts are scaled up if the kernel had to multiplex the group. A
+ * group that never got onto the PMU has no count, like one that could
+ * not be opened.
+ */
+static void perf_read (struct perf_group * g)
+{
+	uint64_t val[3];
+	size_t i;
+	for (i=0; i<NCOUNTERS; ++i) {
+		g->count[i] = -1;
+		if (g->leader < 0 || g->fd[i] < 0)
+			continue;
+		if (read (g->fd[i], val, sizeof (val)) != sizeof (val) || val[2] == 0)
+			continue;
+		g->count[i] = (double)val[0] * val[1] / val[2];
+	}
+}
+
+/* Calibrate the cost of an empty measurement, including the
+ * gettimeofday pair the timing loop puts inside every measurement.
+ */
+static void perf_calibrate (void)
+{
+	struct timeval tp1, tp2;
+	int i;
+	perf_open (&perf_base);
+	for (i=0; i<10000; ++i) {
+		perf_start (&perf_base);
+		gettimeofday (&tp1, 0);
+		gettimeofday (&tp2, 0);
+		perf_stop (&perf_base);
+	}
+	perf_read (&perf_base);
+}
+
+static void perf_report (void)
+{
+	size_t i;
+	perf_read (&perf_alloc);
+	perf_read (&perf_free);
+	printf ("Perf counters per operation (%lld allocs, %lld frees):\n",
+		perf_alloc.ops, perf_free.ops);
+	printf ("  %-14s %12s %12s\n", "", "my_alloc", "my_free");
+	for (i=0; i<NCOUNTERS; ++i) {
+		double base = 0;
+		if (perf_base.count[i] > 0)
+			base = perf_base.count[i] / perf_base.ops;
+		printf ("  %-14s", perf_counters[i].name);
+		if (perf_alloc.ops && perf_alloc.count[i] >= 0)
+			printf (" %12.2lf", perf_alloc.count[i] / perf_alloc.ops - base);
+		else
+			printf (" %12s", "n/a");
+		if (perf_free.ops && perf_free.count[i] >= 0)
+			printf (" %12.2lf", perf_free.count[i] / perf_free.ops - base);
+		else
+			printf (" %12s", "n/a");
+		putchar ('\n');
+	}
+}
+
+#define PERF_START(G) perf_start (&(G))
+#define PERF_STOP(G) perf_stop (&(G))
+#else
+#define PERF_START(G) do { } while (0)
+#define PERF_STOP(G) do { } while (0)
+#endif
+
 struct profile {
 	int (*get)(struct profile * p);
 	int status[10];
+	unsigned short * xsubi; /* own random state, NULL: lrand48 */
 };
 
+static long prand (struct profile * p)
+{
+	if (p->xsubi)
+		return nrand48 (p->xsubi);
+	return lrand48 ();
+}
+
 static int get_oneinthree (struct profile * p)
 {
-	if (lrand48() % 3) {
+	if (prand (p) % 3) {
 		return 1;
 	}
 	return -1;
@@ -50,8 +215,8 @@ static void create_oneinthree (struct profile * p)
 static int get_cluster (struct profile * p)
 {
 	if (p->status[0] == 0) {
-		p->status[0] = 1+lrand48 () % 1000;
-		if (lrand48 () % 2) {
+		p->status[0] = 1+prand (p) % 1000;
+		if (prand (p) % 2) {
 			p->status[1] = -1;
 		} else {
 			p->status[1] = 1;
@@ -70,7 +235,7 @@ static void create_cluster (struct profile * p)
 
 static int get_uniform (struct profile * p)
 {
-	return 8 + 8 * (lrand48()%32);
+	return 8 + 8 * (prand (p)%32);
 }
 
 static int get_increase (struct profile * p)
@@ -117,7 +282,7 @@ static void create_uniform (struct profile * p)
 
 int get_normal1 (struct profile * p)
 {
-	int val = -31 + lrand48() % 32 + lrand48()%32;
+	int val = -31 + prand (p) % 32 + prand (p)%32;
 	if (val < 0)
 		val = -val;
 	val = 8 + 8*val;
@@ -164,6 +329,142 @@ static void create_fixed200 (struct profile * p)
 	p->status[0] = 200;
 }
 
+/* Uniform in (0, 1] */
+static double prand_unit (struct profile * p)
+{
+	return (prand (p) + 1.0) / 2147483648.0;
+}
+
+/* Heavy tailed: P(size > 8*x) = 1/x, up to MAXSIZE */
+static int get_powerlaw (struct profile * p)
+{
+	double x = ceil (1.0 / prand_unit (p));
+	if (x > MAXSIZE / 8)
+		x = MAXSIZE / 8;
+	return 8 * (int)x;
+}
+
+static void create_powerlaw (struct profile * p)
+{
+	p->get = &get_powerlaw;
+}
+
+/* 80% small objects of 16 to 64 bytes, 20% buffers of 1 to 4 KiB */
+static int get_bimodal (struct profile * p)
+{
+	if (prand (p) % 5)
+		return 16 + 8 * (prand (p) % 7);
+	return 1024 + 8 * (prand (p) % ((MAXSIZE - 1024) / 8 + 1));
+}
+
+static void create_bimodal (struct profile * p)
+{
+	p->get = &get_bimodal;
+}
+
+/* Free profiles return the key of a newly allocated object, status[0]
+ * counts allocations. The random profile has no get function, a free
+ * picks a uniformly random live object then.
+ */
+static void create_random (struct profile * p)
+{
+	p->get = NULL;
+}
+
+static int get_fifo (struct profile * p)
+{
+	return ++p->status[0];
+}
+
+static void create_fifo (struct profile * p)
+{
+	p->get = &get_fifo;
+	p->status[0] = 0;
+}
+
+static int get_lifo (struct profile * p)
+{
+	return -++p->status[0];
+}
+
+static void create_lifo (struct profile * p)
+{
+	p->get = &get_lifo;
+	p->status[0] = 0;
+}
+
+/* Exponentially distributed lifetime with the given mean, in allocations */
+static int lifetime (struct profile * p, double mean)
+{
+	return ++p->status[0] + (int)(-mean * log (prand_unit (p)));
+}
+
+static int get_lifetime (struct profile * p)
+{
+	return lifetime (p, 1000);
+}
+
+static void create_lifetime (struct profile * p)
+{
+	p->get = &get_lifetime;
+	p->status[0] = 0;
+}
+
+/* Most objects die young, one in ten lives a thousand times longer */
+static int get_generational (struct profile * p)
+{
+	if (prand (p) % 10)
+		return lifetime (p, 100);
+	return lifetime (p, 100000);
+}
+
+static void create_generational (struct profile * p)
+{
+	p->get = &get_generational;
+	p->status[0] = 0;
+}
+
+/* With -h, objects the free profile lets live for fewer allocations
+ * than this are allocated with MY_SHORT_LIVED, the others with
+ * MY_LONG_LIVED, as a profile guided caller would do.
+ */
+#define SHORT_LIFETIME 1000
+
+static int hint_for (struct profile * fp, int key)
+{
+	return key - fp->status[0] < SHORT_LIFETIME ? MY_SHORT_LIVED : MY_LONG_LIVED;
+}
+
+/* With an ordered free profile, data[0..nptr) is a binary min-heap on key */
+static void swap_data (size_t a, size_t b)
+{
+	struct data tmp = data[a];
+	data[a] = data[b];
+	data[b] = tmp;
+}
+
+static void sift_up (size_t i)
+{
+	while (i > 0 && data[(i-1)/2].key > data[i].key) {
+		swap_data (i, (i-1)/2);
+		i = (i-1)/2;
+	}
+}
+
+static void sift_down (size_t i)
+{
+	while (1) {
+		size_t min = i, l = 2*i+1, r = 2*i+2;
+		if (l < nptr && data[l].key < data[min].key)
+			min = l;
+		if (r < nptr && data[r].key < data[min].key)
+			min = r;
+		if (min == i)
+			break;
+		swap_data (i, min);
+		i = min;
+	}
+}
 
 struct profile_list {
 	char * name;
@@ -186,13 +487,43 @@ struct profile_list size_profiles[] = {
 	{ "fixed200", &create_fixed200 },
 	{ "increase", &create_increase },
 	{ "decrease", &create_decrease },
+	{ "powerlaw", &create_powerlaw },
+	{ "bimodal", &create_bimodal },
 	{ NULL, NULL },
 };
 
+struct profile_list free_profiles[] = {
+	{ "random", &create_random },
+	{ "fifo", &create_fifo },
+	{ "lifo", &create_lifo },
+	{ "lifetime", &create_lifetime },
+	{ "generational", &create_generational },
+	{ NULL, NULL },
+};
+
+
+struct profile_list thread_profiles[] = {
+	{ "local", NULL },
+	{ "prodcons", NULL },
+	{ "shared", NULL },
+	{ NULL, NULL },
+};
+
+struct placement_list {
+	char * name;
+	int mode;
+} placements[] = {
+	{ "buckets", MY_PLACEMENT_BUCKETS },
+	{ "local", MY_PLACEMENT_LOCAL },
+	{ NULL, 0 },
+};
 
 void usage (char * prog) {
 	int i;
-	fprintf (stderr, "usage: %s seed count [ size_profile alloc_profile ]\n", prog);
+	fprintf (stderr, "usage: %s seed count [ size_profile alloc_profile [ free_profile ] ]\n", prog);
+	fprintf (stderr, "       %s -h seed count size_profile alloc_profile lifetime|generational\n", prog);
+	fprintf (stderr, "       %s -t threads seed count [ size_profile thread_profile ]\n", prog);
+	fprintf (stderr, "       %s -l seed count [ size_profile [ placement ] ]\n", prog);
 	fprintf (stderr, "  Known size profiles:");
 	for (i=0; size_profiles[i].name; ++i) {
 		fprintf (stderr, " %s", size_profiles[i].name);
@@ -203,6 +534,24 @@ void usage (char * prog) {
 		fprintf (stderr, " %s", alloc_profiles[i].name);
 	}
 	fprintf (stderr, "\n");
+	fprintf (stderr, "  Known free profiles:");
+	for (i=0; free_profiles[i].name; ++i) {
+		fprintf (stderr, " %s", free_profiles[i].name);
+	}
+	fprintf (stderr, "\n");
+	fprintf (stderr, "  Known thread profiles:");
+	for (i=0; thread_profiles[i].name; ++i) {
+		fprintf (stderr, " %s", thread_profiles[i].name);
+	}
+	fprintf (stderr, "\n");
+	fprintf (stderr, "  Known placements:");
+	for (i=0; placements[i].name; ++i) {
+		fprintf (stderr, " %s", placements[i].name);
+	}
+	fprintf (stderr, "\n");
+	fprintf (stderr, "  Environment:\n");
+	fprintf (stderr, "    MY_ALLOC_STATS=/name  publish the counters for mystat\n");
+	fprintf (stderr, "    MY_ALLOC_TRACE=file   record allocator events for mytrace\n");
 }
 
 int get_idx (struct profile_list * l, char * name)
@@ -215,6 +564,511 @@ int get_idx (struct profile_list * l, char * name)
 	return -1;
 }
 
+/* Threaded benchmark: every thread does count operations, with the
+ * allocator in thread safe mode. The thread profile decides who frees
+ * what:
+ *   local    each thread frees its own objects
+ *   prodcons each thread allocates into a ring that the next thread
+ *            frees from
+ *   shared   objects go into a shared pool of slots, any thread frees
+ *            whatever it finds in a random slot
+ * The run is repeated for 1 up to threads threads. my_alloc_threadsafe
+ * serializes the allocator on one lock, so the speedup shows how much
+ * of the work happens outside of it, not how the allocator scales.
+ */
+#define LOCAL_LIVE 10000
+#define RING_SIZE 1024
+#define SHARED_SLOTS 65536
+#define TAG_MAGIC 0x5a5a5a5a5a5a5a5aULL
+
+struct ring {
+	_Atomic size_t head, tail;
+	char * slot[RING_SIZE];
+};
+
+struct worker {
+	pthread_t thread;
+	int id;
+	int nthreads;
+	int tpidx;
+	long count;
+	unsigned short xsubi[3];
+	struct profile sp;
+	char ** live;
+	size_t nlive;
+	struct ring ring;
+	double secs;
+};
+
+static struct worker * workers;
+static _Atomic(char *) shared_slots[SHARED_SLOTS];
+static pthread_barrier_t start_barrier;
+
+static double now (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* The first word of every object holds a tag derived from its address,
+ * which is checked before it is freed.
+ */
+static char * thread_alloc (struct worker * w)
+{
+	int sz = w->sp.get (&w->sp);
+	char * ptr = my_alloc (sz);
+	my_assert (ptr, "my_alloc hat 0 geliefert");
+	*(uint64_t *)ptr = (uintptr_t)ptr ^ TAG_MAGIC;
+	return ptr;
+}
+
+static void thread_free (char * ptr)
+{
+	/* Allokierter Speicher wurde von einem anderen Thread veraendert. */
+	my_assert (*(uint64_t *)ptr == ((uintptr_t)ptr ^ TAG_MAGIC), "Allokierter Speicherbereich wurde zwischenzeitlich veraendert");
+	my_free (ptr);
+}
+
+static void * thread_main (void * arg)
+{
+	struct worker * w = arg;
+	struct ring * mine = &w->ring;
+	struct ring * next = &workers[(w->id + 1) % w->nthreads].ring;
+	double start;
+	long i;
+	pthread_barrier_wait (&start_barrier);
+	start = now ();
+	for (i=0; i<w->count; ++i) {
+		switch (w->tpidx) {
+		case 0: /* local */
+			if (w->nlive == 0 || (w->nlive < LOCAL_LIVE && nrand48 (w->xsubi) % 2)) {
+				w->live[w->nlive++] = thread_alloc (w);
+			} else {
+				size_t idx = nrand48 (w->xsubi) % w->nlive;
+				thread_free (w->live[idx]);
+				w->live[idx] = w->live[--w->nlive];
+			}
+			break;
+		case 1: /* prodcons */
+			if (i % 2 == 0) {
+				size_t head = atomic_load_explicit (&mine->head, memory_order_relaxed);
+				char * ptr = thread_alloc (w);
+				if (head - atomic_load_explicit (&mine->tail, memory_order_acquire) == RING_SIZE) {
+					thread_free (ptr);
+				} else {
+					mine->slot[head % RING_SIZE] = ptr;
+					atomic_store_explicit (&mine->head, head + 1, memory_order_release);
+				}
+			} else {
+				/* the thread before us produces into our ring, we consume from next's */
+				size_t tail = atomic_load_explicit (&next->tail, memory_order_relaxed);
+				if (tail != atomic_load_explicit (&next->head, memory_order_acquire)) {
+					thread_free (next->slot[tail % RING_SIZE]);
+					atomic_store_explicit (&next->tail, tail + 1, memory_order_release);
+				}
+			}
+			break;
+		case 2: /* shared */
+		{
+			size_t idx = nrand48 (w->xsubi) % SHARED_SLOTS;
+			char * ptr = atomic_exchange (&shared_slots[idx], NULL);
+			if (ptr) {
+				thread_free (ptr);
+			} else {
+				char * expected = NULL;
+				ptr = thread_alloc (w);
+				if (!atomic_compare_exchange_strong (&shared_slots[idx], &expected, ptr))
+					thread_free (ptr);
+			}
+			break;
+		}
+		}
+	}
+	w->secs = now () - start;
+	return NULL;
+}
+
+static int threads_main (int argc, char * argv[])
+{
+	int nthreads, n, t, spidx = 0, tpidx = 0;
+	long seed, count;
+	char ch;
+	double base = 0;
+	if (argc < 5) {
+		usage (argv[0]);
+		return 1;
+	}
+	if (sscanf (argv[2], "%d%c", &nthreads, &ch) != 1 || nthreads < 1
+	    || sscanf (argv[3], "%ld%c", &seed, &ch) != 1
+	    || sscanf (argv[4], "%ld%c", &count, &ch) != 1) {
+		usage (argv[0]);
+		return 1;
+	}
+	if (argc > 5) {
+		if (argc != 7) {
+			usage (argv[0]);
+			return 1;
+		}
+		spidx = get_idx (size_profiles, argv[5]);
+		tpidx = get_idx (thread_profiles, argv[6]);
+		if (spidx < 0 || tpidx < 0) {
+			usage (argv[0]);
+			return 1;
+		}
+	}
+	my_alloc_threadsafe (1);
+	workers = calloc (nthreads, sizeof (struct worker));
+	assert (workers);
+	printf ("Threads  Ops/s per thread (min / avg / max)        Aggregate ops/s  Speedup\n");
+	for (n=1; n<=nthreads; ++n) {
+		double min = 0, max = 0, sum = 0, longest = 0, aggregate;
+		pthread_barrier_init (&start_barrier, NULL, n);
+		for (t=0; t<n; ++t) {
+			struct worker * w = &workers[t];
+			w->id = t;
+			w->nthreads = n;
+			w->tpidx = tpidx;
+			w->count = count;
+			w->xsubi[0] = 0x330e;
+			w->xsubi[1] = seed + t;
+			w->xsubi[2] = (seed + t) >> 16;
+			w->sp.xsubi = w->xsubi;
+			(*size_profiles[spidx].create)(&w->sp);
+			w->live = calloc (LOCAL_LIVE, sizeof (char *));
+			assert (w->live);
+			w->nlive = 0;
+			atomic_init (&w->ring.head, 0);
+			atomic_init (&w->ring.tail, 0);
+		}
+		for (t=0; t<n; ++t) {
+			if (pthread_create (&workers[t].thread, NULL, thread_main, &workers[t])) {
+				perror ("pthread_create");
+				return 1;
+			}
+		}
+		for (t=0; t<n; ++t) {
+			struct worker * w = &workers[t];
+			double rate;
+			pthread_join (w->thread, NULL);
+			rate = w->count / w->secs;
+			if (t == 0 || rate < min)
+				min = rate;
+			if (rate > max)
+				max = rate;
+			sum += rate;
+			if (w->secs > longest)
+				longest = w->secs;
+		}
+		pthread_barrier_destroy (&start_barrier);
+		aggregate = (double)n * count / longest;
+		if (n == 1)
+			base = aggregate;
+		printf ("%7d  %12.0lf / %12.0lf / %12.0lf  %15.0lf  %7.2lf\n",
+			n, min, sum / n, max, aggregate, aggregate / base);
+		/* Clean up for the next round */
+		for (t=0; t<n; ++t) {
+			struct worker * w = &workers[t];
+			while (w->nlive)
+				thread_free (w->live[--w->nlive]);
+			free (w->live);
+			while (w->ring.tail != w->ring.head)
+				thread_free (w->ring.slot[w->ring.tail++ % RING_SIZE]);
+		}
+		for (t=0; t<SHARED_SLOTS; ++t) {
+			char * ptr = atomic_exchange (&shared_slots[t], NULL);
+			if (ptr)
+				thread_free (ptr);
+		}
+	}
+	free (workers);
+	return 0;
+}
+
+/* Locality benchmark: how fast the objects can be used after they were
+ * allocated. First count noise objects age the heap, half of them are
+ * freed again. Then a linked list, a binary search tree and hash chains
+ * of count nodes each are built, with a node size from the size profile
+ * (at least what the node needs). Between two nodes one noise object is
+ * freed and another one allocated, as other work of a program would.
+ * Each structure is then traversed by chasing pointers:
+ *   list  from head to tail
+ *   tree  lookups of random keys
+ *   hash  lookups of random keys, four nodes per chain on average
+ * Reported are the time per node visited (best of LOCALITY_ROUNDS) and
+ * how many nodes are on the same 4 KiB frame as the node visited before.
+ */
+#define LOCALITY_ROUNDS 5
+#define HASH_LOAD 4
+
+struct lnode {
+	struct lnode * next;
+	long key;
+};
+
+struct tnode {
+	struct tnode * left, * right;
+	long key;
+};
+
+static char ** noise;
+static long nnoise;
+static long visits, same_frame;
+
+static void visit (void * prev, void * node)
+{
+	visits++;
+	if (((uintptr_t)prev >> 12) == ((uintptr_t)node >> 12))
+		same_frame++;
+}
+
+static void * node_alloc (struct profile * sp, size_t min)
+{
+	size_t sz = sp->get (sp);
+	long idx = lrand48 () % nnoise;
+	char * ptr;
+	my_free (noise[idx]);
+	noise[idx] = my_alloc (sp->get (sp));
+	my_assert (noise[idx], "my_alloc hat 0 geliefert");
+	ptr = my_alloc (sz < min ? min : sz);
+	my_assert (ptr, "my_alloc hat 0 geliefert");
+	return ptr;
+}
+
+static double list_walk (struct lnode * head, int count_visits)
+{
+	struct lnode * n, * prev = NULL;
+	long sum = 0;
+	double start = now ();
+	for (n = head; n; n = n->next) {
+		sum += n->key;
+		if (count_visits)
+			visit (prev, n);
+		prev = n;
+	}
+	my_assert (sum >= 0, "Allokierter Speicherbereich wurde zwischenzeitlich veraendert");
+	return now () - start;
+}
+
+static double tree_walk (struct tnode * root, long count, int count_visits)
+{
+	long i, found = 0;
+	double start = now ();
+	for (i=0; i<count; ++i) {
+		long key = lrand48 () % (4 * count);
+		struct tnode * n = root, * prev = NULL;
+		while (n && n->key != key) {
+			if (count_visits)
+				visit (prev, n);
+			prev = n;
+			n = key < n->key ? n->left : n->right;
+		}
+		found += n != NULL;
+	}
+	my_assert (found <= count, "Allokierter Speicherbereich wurde zwischenzeitlich veraendert");
+	return now () - start;
+}
+
+static double hash_walk (struct lnode ** table, long buckets, long count, int count_visits)
+{
+	long i, found = 0;
+	double start = now ();
+	for (i=0; i<count; ++i) {
+		long key = lrand48 () % (2 * count);
+		struct lnode * n, * prev = NULL;
+		for (n = table[key % buckets]; n && n->key != key; n = n->next) {
+			if (count_visits)
+				visit (prev, n);
+			prev = n;
+		}
+		found += n != NULL;
+	}
+	my_assert (found <= count, "Allokierter Speicherbereich wurde zwischenzeitlich veraendert");
+	return now () - start;
+}
+
+static void locality_report (char * name, double build, double walk, long count)
+{
+	/* visits holds the steps of one round */
+	printf ("%-6s %14.1lf %17.2lf %11.1lf%%\n", name, build * 1e9 / count,
+		walk * 1e9 / visits, 100.0 * same_frame / visits);
+}
+
+static int locality_main (int argc, char * argv[])
+{
+	int spidx = 0, plidx = 0, r;
+	long seed, count, i, buckets;
+	char ch;
+	double start, build, walk;
+	struct profile sp;
+	struct lnode * head = NULL, ** tail = &head, ** table;
+	struct tnode * root = NULL;
+	char ** aged;
+	if (argc < 4 || argc > 6) {
+		usage (argv[0]);
+		return 1;
+	}
+	if (sscanf (argv[2], "%ld%c", &seed, &ch) != 1
+	    || sscanf (argv[3], "%ld%c", &count, &ch) != 1 || count < 1) {
+		usage (argv[0]);
+		return 1;
+	}
+	if (argc > 4)
+		spidx = get_idx (size_profiles, argv[4]);
+	if (argc > 5) {
+		for (plidx=0; placements[plidx].name && strcasecmp (placements[plidx].name, argv[5]); ++plidx)
+			;
+		if (!placements[plidx].name)
+			plidx = -1;
+	}
+	if (spidx < 0 || plidx < 0) {
+		usage (argv[0]);
+		return 1;
+	}
+	my_alloc_set_placement (placements[plidx].mode);
+	srand48 (seed);
+	sp.xsubi = NULL;
+	(*size_profiles[spidx].create)(&sp);
+
+	/* Age the heap */
+	nnoise = count;
+	noise = aged = calloc (2 * nnoise, sizeof (char *));
+	assert (noise);
+	for (i=0; i<2*nnoise; ++i) {
+		noise[i] = my_alloc (sp.get (&sp));
+		my_assert (noise[i], "my_alloc hat 0 geliefert");
+	}
+	for (i=0; i<nnoise; ++i) {
+		long idx = i + lrand48 () % (2 * nnoise - i);
+		char * tmp = noise[idx];
+		noise[idx] = noise[i];
+		my_free (tmp);
+	}
+	/* Die noch lebende zweite Haelfte */
+	noise += nnoise;
+
+	printf ("Placement %s, %ld nodes\n", placements[plidx].name, count);
+	printf ("Struct  Build ns/node  Traverse ns/node  Same 4K frame\n");
+
+	start = now ();
+	for (i=0; i<count; ++i) {
+		struct lnode * n = node_alloc (&sp, sizeof (struct lnode));
+		n->key = i;
+		n->next = NULL;
+		*tail = n;
+		tail = &n->next;
+	}
+	build = now () - start;
+	visits = same_frame = 0;
+	walk = list_walk (head, 1);
+	for (r=1; r<LOCALITY_ROUNDS; ++r) {
+		double t = list_walk (head, 0);
+		if (t < walk)
+			walk = t;
+	}
+	locality_report ("list", build, walk, count);
+
+	start = now ();
+	for (i=0; i<count; ++i) {
+		struct tnode * n = node_alloc (&sp, sizeof (struct tnode));
+		struct tnode ** link = &root;
+		n->key = lrand48 () % (4 * count);
+		n->left = n->right = NULL;
+		while (*link)
+			link = n->key < (*link)->key ? &(*link)->left : &(*link)->right;
+		*link = n;
+	}
+	build = now () - start;
+	visits = same_frame = 0;
+	walk = tree_walk (root, count, 1);
+	for (r=1; r<LOCALITY_ROUNDS; ++r) {
+		double t = tree_walk (root, count, 0);
+		if (t < walk)
+			walk = t;
+	}
+	locality_report ("tree", build, walk, count);
+
+	buckets = count / HASH_LOAD + 1;
+	table = calloc (buckets, sizeof (struct lnode *));
+	assert (table);
+	start = now ();
+	for (i=0; i<count; ++i) {
+		struct lnode * n = node_alloc (&sp, sizeof (struct lnode));
+		n->key = lrand48 () % (2 * count);
+		n->next = table[n->key % buckets];
+		table[n->key % buckets] = n;
+	}
+	build = now () - start;
+	visits = same_frame = 0;
+	walk = hash_walk (table, buckets, count, 1);
+	for (r=1; r<LOCALITY_ROUNDS; ++r) {
+		double t = hash_walk (table, buckets, count, 0);
+		if (t < walk)
+			walk = t;
+	}
+	locality_report ("hash", build, walk, count);
+	printf ("%zd blocks from the system\n", get_sys_blockcount ());
+	free (table);
+	free (aged);
+	return 0;
+}
+
+/* Memory actually in use during the main test, sampled every
+ * SAMPLE_OPS operations: the resident set of the whole process (which
+ * includes the tester's own data) and the resident pages of the blocks
+ * from get_block_from_system, i.e. the memory the allocator touched and
+ * did not release. Averages are weighted by the time between samples.
+ */
+#define SAMPLE_OPS 1000
+
+struct memory_usage {
+	size_t start, peak, last;
+	double sum; /* bytes times seconds */
+};
+
+static struct memory_usage rss, touched;
+static double first_sample, last_sample;
+
+static size_t rss_bytes (void)
+{
+	long pages = 0, resident = 0;
+	FILE * f = fopen ("/proc/self/statm", "r");
+	if (f) {
+		if (fscanf (f, "%ld %ld", &pages, &resident) != 2)
+			resident = 0;
+		fclose (f);
+	}
+	return resident * sysconf (_SC_PAGESIZE);
+}
+
+static void add_sample (struct memory_usage * m, size_t bytes, double secs)
+{
+	/* The last value held until now */
+	m->sum += m->last * secs;
+	if (last_sample == first_sample)
+		m->start = bytes;
+	m->last = bytes;
+	if (bytes > m->peak)
+		m->peak = bytes;
+}
+
+static void sample_memory (void)
+{
+	double t = now ();
+	if (last_sample == 0)
+		first_sample = last_sample = t;
+	add_sample (&rss, rss_bytes (), t - last_sample);
+	add_sample (&touched, get_sys_resident_pages () * sysconf (_SC_PAGESIZE), t - last_sample);
+	last_sample = t;
+}
+
+static void memory_report (struct memory_usage * m, char * name)
+{
+	double secs = last_sample - first_sample;
+	printf ("%-28s start %8zd, peak %8zd, average %8.0lf\n", name, m->start / 1024,
+		m->peak / 1024, (secs > 0 ? m->sum / secs : (double)m->last) / 1024);
+}
+
 static struct avl_node * areas;
 
 int main (int argc, char * argv[])
@@ -226,18 +1080,39 @@ int main (int argc, char * argv[])
 	int count;
 	struct profile ap;
 	struct profile sp;
-	int apidx = 0, spidx = 0;
+	struct profile fp;
+	int apidx = 0, spidx = 0, fpidx = 0;
+	int hinted = 0, key = 0;
 	double v1, v2, pts;
 	int k, fd;
 	char * p = randdata;
 	init_my_alloc ();
+	/* Zaehler fuer mystat, nur auf Wunsch */
+	if (getenv ("MY_ALLOC_STATS")
+	    && my_alloc_stats_export (getenv ("MY_ALLOC_STATS")) < 0)
+		perror ("my_alloc_stats_export");
+	/* Ereignisse fuer mytrace, mit der voreingestellten Anzahl */
+	if (getenv ("MY_ALLOC_TRACE")
+	    && my_alloc_trace_start (getenv ("MY_ALLOC_TRACE"), 0) < 0)
+		perror ("my_alloc_trace_start");
+	if (argc > 1 && strcmp (argv[1], "-t") == 0)
+		return threads_main (argc, argv);
+	if (argc > 1 && strcmp (argv[1], "-l") == 0)
+		return locality_main (argc, argv);
+	if (argc > 1 && strcmp (argv[1], "-h") == 0) {
+		/* Allokationen mit Hinweis auf die Lebensdauer */
+		hinted = 1;
+		argv[1] = argv[0];
+		argv++;
+		argc--;
+	}
 	areas = create_avl ();
 	fd = open ("/dev/urandom", O_RDONLY);
 	if (fd < 0) {
 		perror ("open");
 		return 1;
 	}
-	k = 20000;
+	k = sizeof (randdata);
 	while (k) {
 		int ret = read (fd, p, k);
 		if (ret <= 0) {
@@ -260,20 +1135,34 @@ int main (int argc, char * argv[])
 		return 1;
 	}
 	if (argc > 3) {
-		if (argc != 5) {
+		if (argc != 5 && argc != 6) {
 			usage (argv[0]);
 			return 1;
 		}
 		spidx = get_idx (size_profiles, argv[3]);
 		apidx = get_idx (alloc_profiles, argv[4]);
-		if (spidx < 0 || apidx < 0) {
+		if (argc == 6)
+			fpidx = get_idx (free_profiles, argv[5]);
+		if (spidx < 0 || apidx < 0 || fpidx < 0) {
 			usage (argv[0]);
 			return 1;
 		}
 	}
+	if (hinted && free_profiles[fpidx].create != &create_lifetime
+	    && free_profiles[fpidx].create != &create_generational) {
+		usage (argv[0]);
+		return 1;
+	}
+#ifdef PERF_COUNTERS
+	perf_calibrate ();
+	perf_open (&perf_alloc);
+	perf_open (&perf_free);
+#endif
 	srand48 (seed);
+	sp.xsubi = ap.xsubi = fp.xsubi = NULL;
 	(*size_profiles[spidx].create)(&sp);
 	(*alloc_profiles[apidx].create)(&ap);
+	(*free_profiles[fpidx].create)(&fp);
 	for (i=0; i<count || nptr; ++i) {
 #if VERBOSE
 		if ((i+1) % 10000 == 0) {
@@ -284,6 +1173,8 @@ int main (int argc, char * argv[])
 #endif
 		struct timeval tp1, tp2;
 		int isalloc = ap.get (&ap);
+		if (i % SAMPLE_OPS == 0)
+			sample_memory ();
 		if (i < count && (nptr == 0 || isalloc > 0)) {
 			int sz = sp.get (&sp);
 			assert (sz && sz % 8 == 0);
@@ -296,9 +1187,17 @@ int main (int argc, char * argv[])
 				maxnalloc = nalloc;
 			if (alloc > maxalloc)
 				maxalloc = alloc;
+			/* Vorher, damit der Hinweis die Lebensdauer kennt */
+			if (fp.get)
+				key = fp.get (&fp);
+			PERF_START (perf_alloc);
 			gettimeofday (&tp1, 0);
-			data[nptr].ptr = my_alloc (sz);
+			if (hinted)
+				data[nptr].ptr = my_alloc_hint (sz, hint_for (&fp, key));
+			else
+				data[nptr].ptr = my_alloc (sz);
 			gettimeofday (&tp2, 0);
+			PERF_STOP (perf_alloc);
 			//printf ("ALLOC: %u %u\n", data[nptr].ptr, sz);
 			usecs += (tp2.tv_sec - tp1.tv_sec) * 1000000
 				 + tp2.tv_usec - tp1.tv_usec;
@@ -329,9 +1228,13 @@ int main (int argc, char * argv[])
 				}
 				insert_avl (&areas, ptr, sz);
 			}
+			if (fp.get) {
+				data[nptr].key = key;
+				sift_up (nptr);
+			}
 			nptr++;
 		} else {
-			int idx = lrand48() % nptr;
+			int idx = fp.get ? 0 : lrand48() % nptr;
 			int offset = lrand48() % 19500;
 			int ret = memcmp (data[idx].ptr, data[idx].contents,
 					  data[idx].len);
@@ -342,9 +1245,11 @@ int main (int argc, char * argv[])
 			data[idx].contents = randdata+offset;
 			alloc -= data[idx].len;
 			nalloc--;
+			PERF_START (perf_free);
 			gettimeofday (&tp1, 0);
 			my_free (data[idx].ptr);
 			gettimeofday (&tp2, 0);
+			PERF_STOP (perf_free);
 			//printf ("FREE: %u %u\n", data[idx].ptr, data[idx].len);
 			usecs += (tp2.tv_sec - tp1.tv_sec) * 1000000
 				 + tp2.tv_usec - tp1.tv_usec;
@@ -364,14 +1269,20 @@ int main (int argc, char * argv[])
 				remove_avl (&areas, n);
 			}
 			data[idx] = data[--nptr];
+			if (fp.get)
+				sift_down (idx);
 		}
 	}
+	sample_memory ();
 #if VERBOSE
 	putchar('\n');
 	printf ("%zd %zd %zd %lld\n", maxalloc, maxnalloc, get_sys_blockcount(), usecs);
 	v1 = -1.0 + ((double) BLOCKSIZE * get_sys_blockcount ())/((double)(maxalloc+8*maxnalloc));
 	v2 = (double)usecs/(double)i;
 	printf ("Relative size overhead: %lf\n", -1.0 + ((double) BLOCKSIZE * get_sys_blockcount ())/((double)(maxalloc+8*maxnalloc)));
+	memory_report (&rss, "Resident memory (KiB):");
+	memory_report (&touched, "Touched system blocks (KiB):");
+	printf ("Relative size overhead (touched): %lf\n", -1.0 + (double) touched.peak/((double)(maxalloc+8*maxnalloc)));
 	printf ("Runtime per operation:  %lf\n", (double)usecs/(double)i);
 	pts = 100.0 - 2.0*v2 - 100.0*v1;
 	if (pts < 0) {
@@ -379,4 +1290,7 @@ int main (int argc, char * argv[])
 	}
 	printf ("Points for this test: %lf\n", pts);
 #endif
+#ifdef PERF_COUNTERS
+	perf_report ();
+#endif
 }
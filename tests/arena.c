@@ -0,0 +1,85 @@
+#include <string.h>
+
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// Arenas: objects are carved one after another, destroying the arena hands its pages back for reuse.
+
+#define OBJECTS 10000
+#define OBJECT_SIZE 104
+
+static char *objects[OBJECTS];
+
+// Fills an arena with numbered objects and checks them
+static my_arena *fill() {
+    my_arena *arena = my_arena_create();
+    CHECK(arena);
+    for (int i = 0; i < OBJECTS; ++i) {
+        objects[i] = my_arena_alloc(arena, OBJECT_SIZE);
+        CHECK(objects[i]);
+        CHECK(((uintptr_t) objects[i] & 7) == 0);
+        memset(objects[i], (char) i, OBJECT_SIZE);
+    }
+    for (int i = 0; i < OBJECTS; ++i) {
+        for (int k = 0; k < OBJECT_SIZE; ++k) {
+            CHECK(objects[i][k] == (char) i);
+        }
+    }
+    return arena;
+}
+
+static void allocate() {
+    my_arena *arena = fill();
+    // Rounded up to 8 bytes
+    char *a = my_arena_alloc(arena, 3);
+    char *b = my_arena_alloc(arena, 3);
+    CHECK(a && b && b - a == 8);
+    CHECK(my_arena_alloc(arena, BLOCKSIZE - sizeof(void *)));
+    CHECK(!my_arena_alloc(arena, BLOCKSIZE));
+    my_arena_destroy(arena);
+}
+
+static void destroyReusesPages() {
+    my_arena_destroy(fill());
+    uint64_t blocks = allocStats->blocksTaken;
+    CHECK(allocStats->emptyPages == (int64_t) blocks);
+
+    // Another arena of the same size needs no new blocks
+    my_arena_destroy(fill());
+    CHECK(allocStats->blocksTaken == blocks);
+    CHECK(allocStats->emptyPages == (int64_t) blocks);
+
+    // Neither does my_alloc, for objects that fit with their headers
+    for (int i = 0; i < OBJECTS / 2; ++i) {
+        objects[i] = my_alloc(OBJECT_SIZE);
+        CHECK(objects[i]);
+    }
+    CHECK(allocStats->blocksTaken == blocks);
+    for (int i = 0; i < OBJECTS / 2; ++i) {
+        my_free(objects[i]);
+    }
+}
+
+static void destroyUnderBudget() {
+    my_alloc_set_budget(16 * BLOCKSIZE);
+    my_arena *arena = my_arena_create();
+    CHECK(arena);
+    int n = 0;
+    while (my_arena_alloc(arena, OBJECT_SIZE)) {
+        ++n;
+    }
+    CHECK(n > 0 && allocStats->blocksTaken == 16);
+    CHECK(!my_alloc(OBJECT_SIZE));
+    my_arena_destroy(arena);
+    CHECK(my_alloc(OBJECT_SIZE));
+}
+
+int main() {
+    testCase cases[] = {
+            {"arena: allocate", allocate},
+            {"arena: destroy reuses pages", destroyReusesPages},
+            {"arena: destroy under budget", destroyUnderBudget},
+            {0, 0},
+    };
+    return runCases(cases);
+}
@@ -0,0 +1,186 @@
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// Bitmap pages: runs of granules that cross bitmap words or end at the last granule of the page don't overlap other
+// objects, and their granules are taken again once freed. Also built with MY_ALLOC_NO_SIMD as bitmap-nosimd.
+
+#define GRANULE 8
+#define PAGE_GRANULES (BLOCKSIZE / GRANULE)
+#define OBJECTS PAGE_GRANULES
+#define MAX_OBJECTS (2 * OBJECTS)
+
+typedef struct object {
+    uint64_t *start;
+    int run;
+} object;
+
+static object objects[MAX_OBJECTS];
+static int count;
+
+// Run lengths 1 to 8 in an order that does not repeat every word
+static int runOf(int i) {
+    return 1 + i * 5 % 8;
+}
+
+static uintptr_t pageOf(void *p) {
+    uint32_t frame = *frameOf(p) & ~FRAME_BITMAP;
+    return ((uintptr_t) p & ~(uintptr_t) ((1 << FRAME_SHIFT) - 1)) - ((uintptr_t) frame << FRAME_SHIFT);
+}
+
+static int granuleOf(void *p) {
+    return (int) (((uintptr_t) p - pageOf(p)) / GRANULE);
+}
+
+// Allocates an object of run granules and writes its number into all of them
+static void allocRun(int i, int run) {
+    uint64_t *p = my_alloc((size_t) run * GRANULE);
+    CHECK(p && isBitmapObject(p));
+    objects[i].start = p;
+    objects[i].run = run;
+    for (int k = 0; k < run; ++k) {
+        p[k] = (uint64_t) i;
+    }
+}
+
+static int byAddress(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t) ((const object *) a)->start;
+    uintptr_t y = (uintptr_t) ((const object *) b)->start;
+    return x < y ? -1 : x > y;
+}
+
+// Checks the contents of the live objects and that no two of them share a granule
+static void checkObjects() {
+    object sorted[MAX_OBJECTS];
+    int live = 0;
+    for (int i = 0; i < count; ++i) {
+        if (objects[i].start) {
+            for (int k = 0; k < objects[i].run; ++k) {
+                CHECK(objects[i].start[k] == (uint64_t) i);
+            }
+            sorted[live++] = objects[i];
+        }
+    }
+    qsort(sorted, live, sizeof(object), byAddress);
+    for (int i = 1; i < live; ++i) {
+        CHECK(sorted[i - 1].start + sorted[i - 1].run <= sorted[i].start);
+    }
+}
+
+// Runs of all lengths over several pages, then single granules up to the end of the last page
+static void fill() {
+    for (count = 0; count < OBJECTS; ++count) {
+        allocRun(count, runOf(count));
+    }
+    uint64_t pages = allocStats->bitmapPages;
+    while (allocStats->bitmapPages == pages) {
+        CHECK(count < MAX_OBJECTS);
+        allocRun(count++, 1);
+    }
+}
+
+static void runsAcrossBoundaries() {
+    fill();
+    int crossWord = 0;
+    int atEnd = 0;
+    for (int i = 0; i < count; ++i) {
+        int g = granuleOf(objects[i].start);
+        int last = g + objects[i].run - 1;
+        CHECK(last < PAGE_GRANULES);
+        crossWord += g / 64 != last / 64;
+        atEnd += last == PAGE_GRANULES - 1;
+    }
+    CHECK(crossWord > 0);
+    CHECK(atEnd > 0);
+    CHECK(allocStats->bitmapPages > 1);
+    checkObjects();
+}
+
+// Runs freed across words are taken again without new pages
+static void freedRunsReused() {
+    fill();
+    uint64_t pages = allocStats->bitmapPages;
+    for (int i = 0; i < count; i += 3) {
+        my_free(objects[i].start);
+        objects[i].start = 0;
+    }
+    checkObjects();
+    for (int i = 0; i < count; i += 3) {
+        allocRun(i, objects[i].run);
+    }
+    CHECK(allocStats->bitmapPages == pages);
+    checkObjects();
+    // Two neighbours freed make room for a longer run
+    for (int i = 0; i + 1 < count; i += 3) {
+        my_free(objects[i].start);
+        my_free(objects[i + 1].start);
+        objects[i].start = objects[i + 1].start = 0;
+    }
+    for (int i = 0; i + 1 < count; i += 3) {
+        int run = objects[i].run + objects[i + 1].run;
+        allocRun(i, run < 8 ? run : 8);
+    }
+    CHECK(allocStats->bitmapPages == pages);
+    checkObjects();
+}
+
+// Only the first word with a free granule is searched on its own, runs behind it are found by the vector search
+static void runBehindFirstWord() {
+    fill();
+    int single = -1;
+    int crossing = -1;
+    for (int i = 0; i < count && crossing < 0; ++i) {
+        int g = granuleOf(objects[i].start);
+        if (objects[i].run == 1 && single < 0) {
+            single = i;
+        } else if (single >= 0 && pageOf(objects[i].start) == pageOf(objects[single].start) &&
+                   g / 64 != (g + objects[i].run - 1) / 64 && g / 64 > granuleOf(objects[single].start) / 64 + 1) {
+            crossing = i;
+        }
+    }
+    CHECK(crossing >= 0);
+    uint64_t pages = allocStats->bitmapPages;
+    // Too small for the run, between live neighbours
+    my_free(objects[single].start);
+    objects[single].start = 0;
+    uint64_t *freed = objects[crossing].start;
+    my_free(freed);
+    allocRun(crossing, objects[crossing].run);
+    CHECK(objects[crossing].start == freed);
+    CHECK(allocStats->bitmapPages == pages);
+    checkObjects();
+}
+
+// The object at the end of a page is only replaced by one that fits before the sentinel
+static void runAtSentinel() {
+    fill();
+    int last = -1;
+    for (int i = 0; i < count && last < 0; ++i) {
+        if (granuleOf(objects[i].start) + objects[i].run == PAGE_GRANULES && objects[i].run < 8) {
+            last = i;
+        }
+    }
+    CHECK(last >= 0);
+    uint64_t *end = objects[last].start;
+    int run = objects[last].run;
+    // The page was filled in order, the freed granules are the only free ones on it
+    my_free(end);
+    allocRun(last, run);
+    CHECK(objects[last].start == end);
+    my_free(end);
+    // A longer run would reach into the sentinel, it goes elsewhere
+    allocRun(last, run + 1);
+    CHECK(objects[last].start != end);
+    CHECK(granuleOf(objects[last].start) + run + 1 <= PAGE_GRANULES);
+    checkObjects();
+}
+
+int main() {
+    testCase cases[] = {
+            {"bitmap: runs across boundaries", runsAcrossBoundaries},
+            {"bitmap: freed runs reused", freedRunsReused},
+            {"bitmap: run behind the first word", runBehindFirstWord},
+            {"bitmap: run at the sentinel", runAtSentinel},
+            {0, 0},
+    };
+    return runCases(cases);
+}
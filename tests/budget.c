@@ -0,0 +1,181 @@
+#include <string.h>
+
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// Memory budget: allocations fail once it is used up, unless the pressure callback frees something.
+
+#define BUDGET_BLOCKS 64
+#define OBJECT_SIZE 1000
+#define MAX_OBJECTS (BUDGET_BLOCKS * BLOCKSIZE / OBJECT_SIZE)
+#define SPAN_SIZE (4 * BLOCKSIZE)
+
+static void *objects[MAX_OBJECTS];
+static int count;
+static int calls;
+static size_t requested;
+
+// Fills the budget with objects of OBJECT_SIZE
+static void fill() {
+    my_alloc_set_budget(BUDGET_BLOCKS * BLOCKSIZE);
+    count = 0;
+    while (count < MAX_OBJECTS && (objects[count] = my_alloc(OBJECT_SIZE))) {
+        ++count;
+    }
+    CHECK(count > 0 && count < MAX_OBJECTS);
+    CHECK(allocStats->blocksTaken <= BUDGET_BLOCKS);
+}
+
+// Frees the object allocated last
+static int freeOne(size_t size) {
+    ++calls;
+    requested = size;
+    if (!count) {
+        return 0;
+    }
+    my_free(objects[--count]);
+    return 1;
+}
+
+static int freeNothing(size_t size) {
+    ++calls;
+    requested = size;
+    return 0;
+}
+
+static void overBudget() {
+    fill();
+    uint64_t failed = allocStats->failedAllocations;
+    CHECK(!my_alloc(OBJECT_SIZE));
+    CHECK(!my_alloc_hint(OBJECT_SIZE, MY_LONG_LIVED));
+    CHECK(allocStats->failedAllocations == failed + 2);
+    // Freeing makes room again
+    my_free(objects[--count]);
+    CHECK(my_alloc(OBJECT_SIZE));
+    // Without a limit there is room for more
+    my_alloc_set_budget(0);
+    CHECK(my_alloc(OBJECT_SIZE));
+    CHECK(allocStats->blocksTaken > BUDGET_BLOCKS);
+}
+
+static void callbackFrees() {
+    fill();
+    my_alloc_set_pressure_callback(freeOne);
+    int before = count;
+    // Each allocation past the budget is served with the space of the object the callback frees
+    for (int i = 0; i < 10; ++i) {
+        CHECK(my_alloc(OBJECT_SIZE));
+    }
+    CHECK(calls == 10 && requested == OBJECT_SIZE);
+    CHECK(count == before - 10);
+    CHECK(allocStats->blocksTaken <= BUDGET_BLOCKS);
+}
+
+static void callbackFreesNothing() {
+    fill();
+    my_alloc_set_pressure_callback(freeNothing);
+    CHECK(!my_alloc(2 * OBJECT_SIZE));
+    CHECK(calls == 1 && requested == 2 * OBJECT_SIZE);
+}
+
+// Memory the allocator holds back itself is reclaimed before the callback is asked
+static void reclaimBeforeCallback() {
+    // Registers the thread while there is memory for it
+    CHECK(my_epoch_enter() == 0);
+    fill();
+    // Room for the batch that keeps the deferred objects
+    my_free(objects[--count]);
+    my_free(objects[--count]);
+    for (int i = 0; i < 10; ++i) {
+        my_free_deferred(objects[--count]);
+    }
+    my_epoch_exit();
+    CHECK(allocStats->deferredObjects == 10);
+    my_alloc_set_pressure_callback(freeOne);
+    for (int i = 0; i < 10; ++i) {
+        CHECK(my_alloc(OBJECT_SIZE));
+    }
+    CHECK(calls == 0 && allocStats->deferredObjects == 0);
+}
+
+// Runs without a span in use go to the pages when the budget is used up
+static void spansGoToPages() {
+    my_alloc_set_budget(BUDGET_BLOCKS * BLOCKSIZE);
+    void *span = my_alloc(SPAN_SIZE);
+    CHECK(span && allocStats->spanBlocks > 0);
+    my_free(span);
+    count = 0;
+    while (count < MAX_OBJECTS && (objects[count] = my_alloc(OBJECT_SIZE))) {
+        ++count;
+    }
+    CHECK(allocStats->spanBlocks == 0);
+    CHECK((size_t) count > (BUDGET_BLOCKS - 1) * (PAGE_SPACE / (OBJECT_SIZE + 8)));
+}
+
+// Frees all objects
+static int freeAll(size_t size) {
+    ++calls;
+    requested = size;
+    while (count) {
+        my_free(objects[--count]);
+    }
+    return 1;
+}
+
+// A span that doesn't fit goes through the callback like any other allocation
+static void spanAsksCallback() {
+    fill();
+    my_alloc_set_pressure_callback(freeNothing);
+    CHECK(!my_alloc(SPAN_SIZE));
+    CHECK(calls == 1 && requested == SPAN_SIZE);
+}
+
+// Empty pages are given back to make room for a run within the budget
+static void emptyPagesMakeRoom() {
+    fill();
+    int filled = count;
+    my_alloc_set_pressure_callback(freeAll);
+    void *span = my_alloc(SPAN_SIZE);
+    CHECK(span && calls == 1);
+    CHECK(allocStats->blocksTaken <= BUDGET_BLOCKS);
+    // Given back by the span, the blocks take objects again
+    my_free(span);
+    my_alloc_set_pressure_callback(0);
+    fill();
+    CHECK(count == filled);
+}
+
+static void trimReleasesEmptyPages() {
+    fill();
+    size_t resident = get_sys_resident_pages();
+    while (count) {
+        my_free(objects[--count]);
+    }
+    size_t released = my_alloc_trim();
+    CHECK(released > 0 || BLOCKSIZE <= sysconf(_SC_PAGESIZE));
+    CHECK(get_sys_resident_pages() <= resident - released / sysconf(_SC_PAGESIZE));
+    // The pages are still there and hold objects again
+    fill();
+    for (int i = 0; i < count; ++i) {
+        memset(objects[i], i, OBJECT_SIZE);
+    }
+    for (int i = 0; i < count; ++i) {
+        CHECK(((unsigned char *) objects[i])[OBJECT_SIZE - 1] == (unsigned char) i);
+        my_free(objects[i]);
+    }
+}
+
+int main() {
+    testCase cases[] = {
+            {"budget: over budget", overBudget},
+            {"budget: callback frees", callbackFrees},
+            {"budget: callback frees nothing", callbackFreesNothing},
+            {"budget: reclaim before callback", reclaimBeforeCallback},
+            {"budget: spans go to pages", spansGoToPages},
+            {"budget: span asks callback", spanAsksCallback},
+            {"budget: empty pages make room", emptyPagesMakeRoom},
+            {"budget: trim empty pages", trimReleasesEmptyPages},
+            {0, 0},
+    };
+    return runCases(cases);
+}
@@ -0,0 +1,52 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "my_alloc.h"
+
+// Minimal test runner. Each case runs in a process of its own, so it starts with a fresh heap and a failing case
+// (a failed check, a crash) does not take the others down.
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1); \
+        } \
+    } while (0)
+
+typedef struct testCase {
+    const char *name;
+    void (*run)();
+} testCase;
+
+// Runs function in a child process. Returns whether it returned normally.
+static int inChild(void (*function)()) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        init_my_alloc();
+        function();
+        exit(0);
+    }
+    int status;
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// Runs the cases up to the one without a name. Returns the exit status for main.
+static int runCases(const testCase *cases) {
+    int failed = 0;
+    for (const testCase *c = cases; c->name; ++c) {
+        int passed = inChild(c->run);
+        printf("%-32s %s\n", c->name, passed ? "ok" : "FAILED");
+        failed += !passed;
+    }
+    return failed ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,154 @@
+#include <pthread.h>
+
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// Deferred frees: an object is not reused while a thread that may still see it is in a read section.
+
+#define READERS 3
+#define WRITERS 2
+#define OPERATIONS 300000
+#define WORDS 15
+#define BUDGET_BLOCKS 64
+#define OBJECT_SIZE 1024
+#define MAX_OBJECTS (BUDGET_BLOCKS * BLOCKSIZE / OBJECT_SIZE)
+
+// Lock-free stack. Every node holds its serial number in all words, a reused node holds another one.
+typedef struct node {
+    struct node *next;
+    uint64_t serial[WORDS];
+} node;
+
+static node *top;
+static uint64_t serials;
+static volatile int stop;
+static int released;
+static void *objects[MAX_OBJECTS];
+
+static void *readStack() {
+    while (!stop) {
+        CHECK(my_epoch_enter() == 0);
+        for (node *n = __atomic_load_n(&top, __ATOMIC_ACQUIRE); n; n = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE)) {
+            uint64_t serial = n->serial[0];
+            for (int i = 1; i < WORDS; ++i) {
+                CHECK(n->serial[i] == serial);
+            }
+        }
+        my_epoch_exit();
+    }
+    return 0;
+}
+
+static void push() {
+    node *n = my_alloc(sizeof(node));
+    CHECK(n);
+    uint64_t serial = __atomic_add_fetch(&serials, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < WORDS; ++i) {
+        n->serial[i] = serial;
+    }
+    n->next = __atomic_load_n(&top, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&top, &n->next, n, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+    }
+}
+
+static void pop() {
+    node *n = __atomic_load_n(&top, __ATOMIC_ACQUIRE);
+    while (n && !__atomic_compare_exchange_n(&top, &n, n->next, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    }
+    if (n) {
+        my_free_deferred(n);
+    }
+}
+
+static void *changeStack() {
+    for (int k = 0; k < OPERATIONS; ++k) {
+        // Reads n->next of the node it pops
+        CHECK(my_epoch_enter() == 0);
+        if (k & 1) {
+            push();
+        } else {
+            pop();
+        }
+        my_epoch_exit();
+    }
+    return 0;
+}
+
+static void noReuseWhileRead() {
+    my_alloc_threadsafe(1);
+    pthread_t readers[READERS], writers[WRITERS];
+    for (int i = 0; i < READERS; ++i) {
+        CHECK(pthread_create(&readers[i], 0, readStack, 0) == 0);
+    }
+    for (int i = 0; i < WRITERS; ++i) {
+        CHECK(pthread_create(&writers[i], 0, changeStack, 0) == 0);
+    }
+    for (int i = 0; i < WRITERS; ++i) {
+        pthread_join(writers[i], 0);
+    }
+    stop = 1;
+    for (int i = 0; i < READERS; ++i) {
+        pthread_join(readers[i], 0);
+    }
+    CHECK(my_epoch_reclaim() == 0);
+}
+
+// Stays in a read section until released
+static void *holdSection() {
+    CHECK(my_epoch_enter() == 0);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    while (!__atomic_load_n(&released, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    my_epoch_exit();
+    return 0;
+}
+
+static void readerHoldsBack() {
+    my_alloc_threadsafe(1);
+    pthread_t reader;
+    CHECK(pthread_create(&reader, 0, holdSection, 0) == 0);
+    while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+    void *object = my_alloc(OBJECT_SIZE);
+    CHECK(object);
+    my_free_deferred(object);
+    CHECK(my_epoch_reclaim() == 1);
+    CHECK(my_alloc(OBJECT_SIZE) != object);
+    __atomic_store_n(&released, 1, __ATOMIC_RELEASE);
+    pthread_join(reader, 0);
+    CHECK(my_epoch_reclaim() == 0);
+}
+
+static int fill() {
+    int count = 0;
+    while (count < MAX_OBJECTS && (objects[count] = my_alloc(OBJECT_SIZE))) {
+        ++count;
+    }
+    return count;
+}
+
+// Deferred objects are freed when the budget is used up
+static void reclaimUnderBudget() {
+    // Registers the thread while there is memory for it
+    CHECK(my_epoch_enter() == 0);
+    my_alloc_set_budget(BUDGET_BLOCKS * BLOCKSIZE);
+    int count = fill();
+    CHECK(count > 0 && count < MAX_OBJECTS);
+    for (int i = 0; i < count; ++i) {
+        my_free_deferred(objects[i]);
+    }
+    my_epoch_exit();
+    CHECK(fill() == count);
+}
+
+int main() {
+    testCase cases[] = {
+            {"epoch: no reuse while read", noReuseWhileRead},
+            {"epoch: reader holds back", readerHoldsBack},
+            {"epoch: reclaim under budget", reclaimUnderBudget},
+            {0, 0},
+    };
+    return runCases(cases);
+}
@@ -0,0 +1,108 @@
+#include <string.h>
+
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// Handles: objects keep their contents when the compactor moves them, pinned objects stay where they are.
+
+#define HANDLES 20000
+#define PINNED 100
+
+static my_handle handles[HANDLES];
+static void *addressOf[HANDLES];
+
+static size_t sizeOf(int i) {
+    return 16 + i % 29 * 8;
+}
+
+static void fill(int i) {
+    memset(my_hpin(handles[i]), (char) i, sizeOf(i));
+    my_hunpin(handles[i]);
+}
+
+static void verify(int i) {
+    char *object = my_hpin(handles[i]);
+    for (size_t k = 0; k < sizeOf(i); ++k) {
+        CHECK(object[k] == (char) i);
+    }
+    my_hunpin(handles[i]);
+}
+
+// Allocates all handles and frees three of four, leaving sparse pages
+static void fragment() {
+    for (int i = 0; i < HANDLES; ++i) {
+        handles[i] = my_halloc(sizeOf(i));
+        CHECK(handles[i]);
+        fill(i);
+    }
+    for (int i = 0; i < HANDLES; ++i) {
+        if (i % 4) {
+            my_hfree(handles[i]);
+            handles[i] = 0;
+        }
+    }
+}
+
+static void compactKeepsContents() {
+    fragment();
+    // Keep the first survivors pinned, they must not move
+    for (int i = 0; i < HANDLES; i += 4) {
+        addressOf[i] = my_hpin(handles[i]);
+        if (i >= PINNED * 4) {
+            my_hunpin(handles[i]);
+        }
+    }
+    int64_t empty = allocStats->emptyPages;
+    size_t released = my_hcompact(1000);
+    CHECK(released > 0);
+    CHECK(allocStats->emptyPages == empty + (int64_t) released);
+
+    int moved = 0;
+    for (int i = 0; i < HANDLES; i += 4) {
+        char *object = my_hpin(handles[i]);
+        if (i < PINNED * 4) {
+            CHECK(object == addressOf[i]);
+            my_hunpin(handles[i]);
+        }
+        moved += object != addressOf[i];
+        my_hunpin(handles[i]);
+        verify(i);
+    }
+    CHECK(moved > 0);
+
+    // Still usable after moving: free and reallocate
+    for (int i = 0; i < HANDLES; i += 8) {
+        my_hfree(handles[i]);
+        handles[i] = my_halloc(sizeOf(i));
+        CHECK(handles[i]);
+        fill(i);
+    }
+    for (int i = 0; i < HANDLES; i += 4) {
+        verify(i);
+    }
+}
+
+// An allocation that would exceed the budget compacts first
+static void budgetCompacts() {
+    fragment();
+    my_alloc_set_budget(allocStats->blocksTaken * BLOCKSIZE);
+    // Only compaction can free a whole page
+    CHECK(allocStats->emptyPages == 0);
+    int taken = 0;
+    while (my_alloc(PAGE_SPACE)) {
+        ++taken;
+    }
+    CHECK(taken > 0);
+    for (int i = 0; i < HANDLES; i += 4) {
+        verify(i);
+    }
+}
+
+int main() {
+    testCase cases[] = {
+            {"handles: compact keeps contents", compactKeepsContents},
+            {"handles: budget compacts", budgetCompacts},
+            {0, 0},
+    };
+    return runCases(cases);
+}
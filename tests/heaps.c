@@ -0,0 +1,85 @@
+#include <string.h>
+
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// Heaps: each keeps its pages to itself until it is destroyed, then they go to my_alloc.
+
+#define OBJECTS 20000
+// More pages than the first directory of a heap holds
+#define PAGES 3000
+
+static void *objects[2][OBJECTS];
+
+static size_t sizeOf(int i) {
+    return 8 + i % 97 * 8;
+}
+
+static void keepApart() {
+    my_heap *heaps[2] = {my_heap_create(), my_heap_create()};
+    CHECK(heaps[0] && heaps[1]);
+    for (int i = 0; i < OBJECTS; ++i) {
+        for (int h = 0; h < 2; ++h) {
+            objects[h][i] = my_heap_alloc(heaps[h], sizeOf(i));
+            CHECK(objects[h][i]);
+            memset(objects[h][i], h, sizeOf(i));
+        }
+    }
+    for (int i = 0; i < OBJECTS; ++i) {
+        for (int h = 0; h < 2; ++h) {
+            for (size_t k = 0; k < sizeOf(i); ++k) {
+                CHECK(((char *) objects[h][i])[k] == h);
+            }
+        }
+    }
+
+    // The pages of an emptied heap are not available to the other one, or to my_alloc
+    uint64_t blocks = allocStats->blocksTaken;
+    for (int i = 0; i < OBJECTS; ++i) {
+        my_heap_free(heaps[0], objects[0][i]);
+    }
+    for (int i = 0; i < OBJECTS; ++i) {
+        CHECK(my_heap_alloc(heaps[1], sizeOf(i)));
+    }
+    CHECK(allocStats->blocksTaken > blocks + blocks / 3);
+    blocks = allocStats->blocksTaken;
+    CHECK(my_alloc(PAGE_SPACE));
+    CHECK(allocStats->blocksTaken == blocks + 1);
+}
+
+static void destroyReturnsPages() {
+    uint64_t before = allocStats->blocksTaken;
+    my_heap *heap = my_heap_create();
+    CHECK(heap);
+    for (int i = 0; i < PAGES; ++i) {
+        CHECK(my_heap_alloc(heap, PAGE_SPACE));
+    }
+    for (int i = 0; i < OBJECTS; ++i) {
+        CHECK(my_heap_alloc(heap, sizeOf(i)));
+    }
+    uint64_t blocks = allocStats->blocksTaken - before;
+    CHECK(allocStats->emptyPages == 0);
+
+    // Every page, directory and the block of the heap itself, with its objects still in them
+    my_heap_destroy(heap);
+    CHECK(allocStats->emptyPages == (int64_t) blocks);
+    CHECK(allocStats->liveBytes == 0);
+    CHECK(allocStats->allocations == allocStats->frees);
+
+    // my_alloc and a new heap take them instead of new blocks
+    for (int i = 0; i < PAGES; ++i) {
+        CHECK(my_alloc(PAGE_SPACE));
+    }
+    heap = my_heap_create();
+    CHECK(heap && my_heap_alloc(heap, PAGE_SPACE));
+    CHECK(allocStats->blocksTaken == before + blocks);
+}
+
+int main() {
+    testCase cases[] = {
+            {"heaps: keep apart", keepApart},
+            {"heaps: destroy returns pages", destroyReturnsPages},
+            {0, 0},
+    };
+    return runCases(cases);
+}
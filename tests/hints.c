@@ -0,0 +1,85 @@
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// Lifetime hints: objects of each hint come from pages of their own pool, so freeing the short-lived ones empties
+// their pages while the others stay.
+
+#define OBJECTS 3000
+
+static void *objects[OBJECTS];
+
+static int hintOf(int i) {
+    return i % 3;
+}
+
+static size_t sizeOf(int i) {
+    // Small objects without a hint go to bitmap pages, these to the pool pages
+    return 72 + (size_t) i * 37 % 900 / 8 * 8;
+}
+
+// Checks that every object and free space on the page of object is in pool
+static void checkPage(void *object, uint32_t pool) {
+    char *p = object;
+    while (headerOf(p)->precedingObjectSize != START_OF_PAGE) {
+        p -= realSize(headerOf(p)->precedingObjectSize) + sizeof(header);
+    }
+    while (headerOf(p)->tailingObjectSize != END_OF_PAGE) {
+        CHECK(poolOf(headerOf(p)->tailingObjectSize) == pool);
+        p += realSize(headerOf(p)->tailingObjectSize) + sizeof(header);
+    }
+}
+
+static void allocateMixed() {
+    for (int i = 0; i < OBJECTS; ++i) {
+        objects[i] = my_alloc_hint(sizeOf(i), hintOf(i));
+        CHECK(objects[i]);
+    }
+}
+
+static void separatePages() {
+    allocateMixed();
+    for (int i = 0; i < OBJECTS; ++i) {
+        CHECK(poolOf(headerOf(objects[i])->tailingObjectSize) == (uint32_t) hintOf(i));
+        checkPage(objects[i], hintOf(i));
+    }
+    // Freed spaces stay in the pool of their page and are reused by objects of the same hint
+    for (int i = 0; i < OBJECTS; i += 6) {
+        my_free(objects[i]);
+        my_free(objects[i + 1]);
+    }
+    for (int i = 0; i < OBJECTS; i += 6) {
+        objects[i + 1] = my_alloc_hint(sizeOf(i + 1), MY_SHORT_LIVED);
+        CHECK(objects[i + 1]);
+        checkPage(objects[i + 1], MY_SHORT_LIVED);
+    }
+}
+
+static void shortLivedPagesEmpty() {
+    allocateMixed();
+    int64_t emptyPages = allocStats->emptyPages;
+    uint64_t newPages = allocStats->newPages;
+    for (int i = MY_SHORT_LIVED; i < OBJECTS; i += 3) {
+        my_free(objects[i]);
+    }
+    // All pages of the pool but the active one
+    CHECK(allocStats->emptyPages >= emptyPages + 10);
+    // Which take objects of any hint
+    for (int i = 0; i < 10; ++i) {
+        CHECK(my_alloc_hint(PAGE_SPACE / 2, MY_LONG_LIVED));
+    }
+    CHECK(allocStats->newPages == newPages);
+    for (int i = 0; i < OBJECTS; ++i) {
+        if (hintOf(i) != MY_SHORT_LIVED) {
+            checkPage(objects[i], hintOf(i));
+        }
+    }
+}
+
+int main() {
+    testCase cases[] = {
+            {"hints: separate pages", separatePages},
+            {"hints: short-lived pages empty", shortLivedPagesEmpty},
+            {0, 0},
+    };
+    return runCases(cases);
+}
@@ -0,0 +1,164 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// Inline fast path of my_alloc for constant sizes: it pops the objects the function would return and counts them the
+// same way, and leaves everything it does not handle to the function.
+
+#define OBJECTS 1000
+// A size with a bucket of its own, see EXACT_LISTS
+#define OBJECT_SIZE 104
+#define THREADS 4
+#define THREAD_OBJECTS 100
+#define ROUNDS 20000
+
+static void *objects[2 * OBJECTS];
+static void *threadObjects[THREADS][THREAD_OBJECTS];
+
+static int bucket() {
+    return bucketIndex(OBJECT_SIZE);
+}
+
+// Puts free spaces of exactly OBJECT_SIZE into the bucket of the pool, between live objects so they don't coalesce
+static void fillBucket(int hint) {
+    for (int i = 0; i < 2 * OBJECTS; ++i) {
+        objects[i] = my_alloc_hint(OBJECT_SIZE, hint);
+        CHECK(objects[i]);
+    }
+    for (int i = 0; i < 2 * OBJECTS; i += 2) {
+        my_free(objects[i]);
+    }
+    CHECK(EXACT_LISTS >> bucket() & 1);
+    CHECK(allocStats->freeSpaces[hint][bucket()] > 0);
+}
+
+static void sameObjects() {
+    fillBucket(0);
+    int n = (int) allocStats->freeSpaces[0][bucket()];
+    void *expected[2 * OBJECTS];
+    for (int i = 0; i < n; ++i) {
+        expected[i] = (my_alloc)(OBJECT_SIZE);
+    }
+    struct my_alloc_stats after = *allocStats;
+    // Freed in reverse, the bucket is a stack again as it was
+    for (int i = n - 1; i >= 0; --i) {
+        my_free(expected[i]);
+    }
+    CHECK(allocStats->freeSpaces[0][bucket()] == n);
+
+    for (int i = 0; i < n; ++i) {
+        CHECK(my_alloc(OBJECT_SIZE) == expected[i]);
+    }
+    CHECK(defaultLists.buckets[0][bucket()] == 0);
+    CHECK(!(defaultLists.nonEmptyBuckets[0] >> bucket() & 1));
+    CHECK(allocStats->liveBytes == after.liveBytes);
+    CHECK(allocStats->allocations == after.allocations + (uint64_t) n);
+    CHECK(allocStats->emptyPages == after.emptyPages);
+    CHECK(memcmp(allocStats->freeSpaces, after.freeSpaces, sizeof(after.freeSpaces)) == 0);
+    // And they are objects like any other
+    for (int i = 0; i < n; ++i) {
+        CHECK(realSize(headerOf(expected[i])->tailingObjectSize) == OBJECT_SIZE);
+        CHECK(!(headerOf(expected[i])->tailingObjectSize & 1));
+        my_free(expected[i]);
+    }
+}
+
+// Free spaces of another pool are not in the buckets the fast path pops from
+static void otherPool() {
+    fillBucket(MY_SHORT_LIVED);
+    int64_t spaces = allocStats->freeSpaces[MY_SHORT_LIVED][bucket()];
+    void *object = my_alloc(OBJECT_SIZE);
+    CHECK(object && poolOf(headerOf(object)->tailingObjectSize) == 0);
+    CHECK(allocStats->freeSpaces[MY_SHORT_LIVED][bucket()] == spaces);
+}
+
+static void sampling() {
+    fillBucket(0);
+    CHECK(my_alloc_profile_start(8, 0) == 0);
+    int sampled = 0;
+    for (int i = 0; i < 10; ++i) {
+        void *object = my_alloc(OBJECT_SIZE);
+        CHECK(object);
+        sampled += (footerOf(object)->precedingObjectSize & SAMPLED) != 0;
+    }
+    CHECK(sampled > 0);
+}
+
+static void tracing() {
+    char path[] = "/tmp/inline.XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+    fillBucket(0);
+    CHECK(my_alloc_trace_start(path, 0) == 0);
+    struct my_alloc_trace_header *h = traceHeader;
+    uint64_t written = h->written;
+    void *object = my_alloc(OBJECT_SIZE);
+    CHECK(object);
+    struct my_alloc_trace_record *records = (struct my_alloc_trace_record *) (h + 1);
+    int found = 0;
+    for (uint64_t n = written; n < h->written; ++n) {
+        found |= records[n].event == MY_TRACE_ALLOC && records[n].address == (uintptr_t) object;
+    }
+    my_alloc_trace_stop();
+    unlink(path);
+    CHECK(found);
+}
+
+static void localPlacement() {
+    fillBucket(0);
+    my_alloc_set_placement(MY_PLACEMENT_LOCAL);
+    char *first = my_alloc(OBJECT_SIZE);
+    CHECK(first);
+    // Carved from the active space, whose rest follows the object
+    CHECK(activeSpaces[0] == first + OBJECT_SIZE + sizeof(header));
+    CHECK(my_alloc(OBJECT_SIZE) == first + OBJECT_SIZE + sizeof(header));
+}
+
+// Allocates and frees in rounds, checking that no other thread got one of its objects
+static void *allocateMany(void *objects) {
+    void **mine = objects;
+    uintptr_t id = (uintptr_t) objects;
+    for (int round = 0; round < ROUNDS; ++round) {
+        for (int i = 0; i < THREAD_OBJECTS; ++i) {
+            mine[i] = my_alloc(OBJECT_SIZE);
+            CHECK(mine[i]);
+            *(uintptr_t *) mine[i] = id;
+        }
+        for (int i = 0; i < THREAD_OBJECTS; ++i) {
+            CHECK(*(uintptr_t *) mine[i] == id);
+            my_free(mine[i]);
+        }
+    }
+    return 0;
+}
+
+// Under the lock, no two threads pop the same space
+static void lockTaken() {
+    fillBucket(0);
+    my_alloc_threadsafe(1);
+    uint64_t allocations = allocStats->allocations;
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; ++i) {
+        CHECK(pthread_create(&threads[i], 0, allocateMany, threadObjects[i]) == 0);
+    }
+    for (int i = 0; i < THREADS; ++i) {
+        pthread_join(threads[i], 0);
+    }
+    CHECK(allocStats->allocations == allocations + THREADS * ROUNDS * THREAD_OBJECTS);
+}
+
+int main() {
+    testCase cases[] = {
+            {"inline: same objects", sameObjects},
+            {"inline: other pool", otherPool},
+            {"inline: sampling", sampling},
+            {"inline: tracing", tracing},
+            {"inline: local placement", localPlacement},
+            {"inline: thread safe", lockTaken},
+            {0, 0},
+    };
+    return runCases(cases);
+}
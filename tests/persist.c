@@ -0,0 +1,261 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// Persistent heap: data written by one process is found by the next, and files the heap can't use are refused.
+// Every process below is a restart.
+
+#define NODES 10000
+#define SAMPLED_OBJECTS 1000
+#define UNSYNCED_OBJECTS 100
+#define UNSYNCED_SIZE 200
+
+typedef struct node {
+    struct node *next;
+    uint64_t value;
+    // Sizes vary with the value, so the nodes spread over many buckets
+    char payload[];
+} node;
+
+static char path[] = "/tmp/persist.XXXXXX";
+
+static size_t payloadSize(uint64_t value) {
+    return value % 61 * 8;
+}
+
+static void createFile(char *name) {
+    int fd = mkstemp(name);
+    CHECK(fd >= 0);
+    close(fd);
+}
+
+// Overwrites a word of the superblock
+static void patchSuperblock(int word, uint64_t value) {
+    int fd = open(path, O_RDWR);
+    CHECK(fd >= 0);
+    CHECK(pwrite(fd, &value, sizeof(value), (off_t) (word * sizeof(value))) == sizeof(value));
+    close(fd);
+}
+
+static void writeList() {
+    CHECK(my_alloc_persistent(path) == 0);
+    CHECK(my_alloc_persistent_root() == 0);
+    node *list = 0;
+    for (uint64_t i = 0; i < NODES; ++i) {
+        node *n = my_alloc(sizeof(node) + payloadSize(i));
+        CHECK(n);
+        n->next = list;
+        n->value = i;
+        memset(n->payload, (int) i, payloadSize(i));
+        list = n;
+    }
+    my_alloc_persistent_set_root(list);
+    // Spans are not kept in the file
+    CHECK(!my_alloc(2 * BLOCKSIZE));
+}
+
+static void verifyList() {
+    CHECK(my_alloc_persistent(path) == 0);
+    uint64_t expected = NODES;
+    for (node *n = my_alloc_persistent_root(); n; n = n->next) {
+        CHECK(n->value == --expected);
+        for (size_t k = 0; k < payloadSize(n->value); ++k) {
+            CHECK(n->payload[k] == (char) n->value);
+        }
+    }
+    CHECK(expected == 0);
+}
+
+// Frees every other node and allocates new ones from the restored free lists
+static void replaceHalf() {
+    CHECK(my_alloc_persistent(path) == 0);
+    for (node *n = my_alloc_persistent_root(); n && n->next; n = n->next) {
+        node *old = n->next;
+        node *fresh = my_alloc(sizeof(node) + payloadSize(old->value));
+        CHECK(fresh);
+        fresh->next = old->next;
+        fresh->value = old->value;
+        memset(fresh->payload, (int) old->value, payloadSize(old->value));
+        n->next = fresh;
+        my_free(old);
+        n = fresh;
+    }
+}
+
+static void refuseFile() {
+    CHECK(my_alloc_persistent(path) == -1);
+    CHECK(errno == EINVAL);
+    // The failed attempt left nothing behind, another file still works
+    char other[] = "/tmp/persist.XXXXXX";
+    createFile(other);
+    int opened = my_alloc_persistent(other);
+    unlink(other);
+    CHECK(opened == 0);
+}
+
+static void writeSampled() {
+    CHECK(my_alloc_persistent(path) == 0);
+    CHECK(my_alloc_profile_start(64, 0) == 0);
+    void **objects = my_alloc(SAMPLED_OBJECTS * sizeof(void *));
+    CHECK(objects);
+    int sampled = 0;
+    for (int i = 0; i < SAMPLED_OBJECTS; ++i) {
+        objects[i] = my_alloc(200);
+        CHECK(objects[i]);
+        sampled += (footerOf(objects[i])->precedingObjectSize & SAMPLED) != 0;
+    }
+    CHECK(sampled > 0);
+    my_alloc_persistent_set_root(objects);
+}
+
+// Without the profiler of the process that sampled them
+static void freeSampled() {
+    CHECK(my_alloc_persistent(path) == 0);
+    void **objects = my_alloc_persistent_root();
+    for (int i = 0; i < SAMPLED_OBJECTS; ++i) {
+        CHECK(!(footerOf(objects[i])->precedingObjectSize & SAMPLED));
+        my_free(objects[i]);
+    }
+    my_free(objects);
+}
+
+// Allocates after the last sync and leaves without the sync at exit
+static void writeUnsynced() {
+    CHECK(my_alloc_persistent(path) == 0);
+    CHECK(my_alloc_persistent_sync() == 0);
+    // The list of writeList goes behind the objects
+    void **objects = my_alloc((UNSYNCED_OBJECTS + 1) * sizeof(void *));
+    CHECK(objects);
+    objects[UNSYNCED_OBJECTS] = my_alloc_persistent_root();
+    for (int i = 0; i < UNSYNCED_OBJECTS; ++i) {
+        objects[i] = my_alloc(UNSYNCED_SIZE);
+        CHECK(objects[i]);
+        memset(objects[i], i, UNSYNCED_SIZE);
+    }
+    my_alloc_persistent_set_root(objects);
+    _exit(0);
+}
+
+// New objects don't overlap those allocated after the last sync
+static void allocateAfterUnsynced() {
+    CHECK(my_alloc_persistent(path) == 0);
+    char **objects = my_alloc_persistent_root();
+    for (int i = 0; i < UNSYNCED_OBJECTS; ++i) {
+        char *fresh = my_alloc(UNSYNCED_SIZE);
+        CHECK(fresh);
+        memset(fresh, 0xff, UNSYNCED_SIZE);
+        for (int k = 0; k < UNSYNCED_OBJECTS; ++k) {
+            CHECK(fresh + UNSYNCED_SIZE <= objects[k] || objects[k] + UNSYNCED_SIZE <= fresh);
+        }
+        CHECK(fresh + UNSYNCED_SIZE <= (char *) objects || (char *) (objects + UNSYNCED_OBJECTS + 1) <= fresh);
+    }
+    for (int i = 0; i < UNSYNCED_OBJECTS; ++i) {
+        for (int k = 0; k < UNSYNCED_SIZE; ++k) {
+            CHECK(objects[i][k] == (char) i);
+        }
+    }
+    // The lists are sound again: free everything and allocate it once more
+    for (int i = 0; i < UNSYNCED_OBJECTS; ++i) {
+        my_free(objects[i]);
+    }
+    for (int i = 0; i < UNSYNCED_OBJECTS; ++i) {
+        CHECK(my_alloc(UNSYNCED_SIZE));
+    }
+    my_alloc_persistent_set_root(objects[UNSYNCED_OBJECTS]);
+}
+
+static blkcnt_t fileBlocks() {
+    struct stat st;
+    CHECK(stat(path, &st) == 0);
+    return st.st_blocks;
+}
+
+// Trimmed empty pages leave holes in the file, and are zero when they are used again
+static void trimHoles() {
+    CHECK(my_alloc_persistent(path) == 0);
+    void *objects[UNSYNCED_OBJECTS * 10];
+    for (int i = 0; i < UNSYNCED_OBJECTS * 10; ++i) {
+        objects[i] = my_alloc(UNSYNCED_SIZE);
+        CHECK(objects[i]);
+        memset(objects[i], 0xff, UNSYNCED_SIZE);
+    }
+    for (int i = 0; i < UNSYNCED_OBJECTS * 10; ++i) {
+        my_free(objects[i]);
+    }
+    blkcnt_t before = fileBlocks();
+    CHECK(my_alloc_trim() > 0 || BLOCKSIZE <= sysconf(_SC_PAGESIZE));
+    CHECK(fileBlocks() < before || BLOCKSIZE <= sysconf(_SC_PAGESIZE));
+    for (int i = 0; i < UNSYNCED_OBJECTS * 10; ++i) {
+        objects[i] = my_alloc(UNSYNCED_SIZE);
+        CHECK(objects[i]);
+        memset(objects[i], i, UNSYNCED_SIZE);
+    }
+    for (int i = 0; i < UNSYNCED_OBJECTS * 10; ++i) {
+        CHECK(((char *) objects[i])[UNSYNCED_SIZE - 1] == (char) i);
+    }
+}
+
+static void writeAndReopen() {
+    createFile(path);
+    CHECK(inChild(writeList));
+    CHECK(inChild(verifyList));
+    CHECK(inChild(replaceHalf));
+    CHECK(inChild(verifyList));
+    unlink(path);
+}
+
+static void magicMismatch() {
+    createFile(path);
+    CHECK(inChild(writeList));
+    patchSuperblock(0, 0x30434f4c4c41594dULL);  // "MYALLOC0"
+    CHECK(inChild(refuseFile));
+    unlink(path);
+}
+
+static void sizeClassesMismatch() {
+    createFile(path);
+    CHECK(inChild(writeList));
+    // sizeClasses is the fifth word of the superblock
+    patchSuperblock(4, SIZE_CLASSES_ID + 1);
+    CHECK(inChild(refuseFile));
+    unlink(path);
+}
+
+static void staleSampledMarks() {
+    createFile(path);
+    CHECK(inChild(writeSampled));
+    CHECK(inChild(freeSampled));
+    unlink(path);
+}
+
+static void exitWithoutSync() {
+    createFile(path);
+    CHECK(inChild(writeList));
+    CHECK(inChild(writeUnsynced));
+    CHECK(inChild(allocateAfterUnsynced));
+    CHECK(inChild(verifyList));
+    unlink(path);
+}
+
+static void trimPunchesHoles() {
+    createFile(path);
+    CHECK(inChild(trimHoles));
+    unlink(path);
+}
+
+int main() {
+    testCase cases[] = {
+            {"persist: write and reopen", writeAndReopen},
+            {"persist: magic mismatch", magicMismatch},
+            {"persist: size classes mismatch", sizeClassesMismatch},
+            {"persist: stale sampled marks", staleSampledMarks},
+            {"persist: exit without sync", exitWithoutSync},
+            {"persist: trim punches holes", trimPunchesHoles},
+            {0, 0},
+    };
+    return runCases(cases);
+}
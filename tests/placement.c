@@ -0,0 +1,148 @@
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// Local placement: objects are carved one after another from an active space per pool. Switching the mode puts the
+// active spaces back into the lists, so no free space is lost to either mode.
+
+#define OBJECTS 4000
+#define MAX_SPACES 100000
+#define ROUNDS 20
+
+static void *objects[OBJECTS];
+static void *listed[MAX_SPACES];
+
+static size_t sizeOf(int i) {
+    return 72 + (size_t) i * 29 % 700 / 8 * 8;
+}
+
+static int compareAddresses(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t) *(void *const *) a;
+    uintptr_t y = (uintptr_t) *(void *const *) b;
+    return x < y ? -1 : x > y;
+}
+
+static int isListed(void *space, int count) {
+    return bsearch(&space, listed, count, sizeof(void *), compareAddresses) != 0;
+}
+
+static int isActive(void *space) {
+    for (int pool = 0; pool < NUMBER_OF_POOLS; ++pool) {
+        if (activeSpaces[pool] == space) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Every free space on the pages of the objects is in a list or active, and the counters agree with the lists.
+// Returns the number of listed spaces.
+static int checkSpaces() {
+    int count = 0;
+    for (int pool = 0; pool < NUMBER_OF_POOLS; ++pool) {
+        for (int i = 0; i < NUMBER_OF_LISTS; ++i) {
+            for (doublePointer *p = defaultLists.buckets[pool][i]; p; p = secondPointer(*p)) {
+                CHECK(count < MAX_SPACES);
+                listed[count++] = p;
+            }
+        }
+    }
+    for (doublePointer *p = defaultLists.emptyPages; p; p = secondPointer(*p)) {
+        CHECK(count < MAX_SPACES);
+        listed[count++] = p;
+    }
+    qsort(listed, count, sizeof(void *), compareAddresses);
+
+    for (int i = 0; i < OBJECTS; ++i) {
+        if (!objects[i] || isBitmapObject(objects[i])) {
+            continue;
+        }
+        char *p = objects[i];
+        while (headerOf(p)->precedingObjectSize != START_OF_PAGE) {
+            p -= realSize(headerOf(p)->precedingObjectSize) + sizeof(header);
+        }
+        for (uint32_t s; (s = headerOf(p)->tailingObjectSize) != END_OF_PAGE; p += realSize(s) + sizeof(header)) {
+            if (s & 1) {
+                CHECK(isListed(p, count) != isActive(p));
+            }
+        }
+    }
+
+    struct my_alloc_stats counted = *allocStats;
+    countFreeSpaces();
+    for (int pool = 0; pool < NUMBER_OF_POOLS; ++pool) {
+        for (int i = 0; i < NUMBER_OF_LISTS; ++i) {
+            CHECK(counted.freeSpaces[pool][i] == allocStats->freeSpaces[pool][i]);
+        }
+    }
+    CHECK(counted.emptyPages == allocStats->emptyPages);
+    return count;
+}
+
+static void nextToEachOther() {
+    my_alloc_set_placement(MY_PLACEMENT_LOCAL);
+    char *previous = my_alloc(sizeOf(0));
+    // As many as surely fit on the page of the first one
+    for (int i = 1; i < (int) (PAGE_SPACE / 2 / (sizeOf(0) + sizeof(header))); ++i) {
+        char *object = my_alloc(sizeOf(0));
+        CHECK(object == previous + sizeOf(0) + sizeof(header));
+        previous = object;
+    }
+}
+
+static void switchRetiresActiveSpaces() {
+    my_alloc_set_placement(MY_PLACEMENT_LOCAL);
+    for (int i = 0; i < OBJECTS; ++i) {
+        objects[i] = my_alloc_hint(sizeOf(i), i % 3);
+        CHECK(objects[i]);
+    }
+    // Freed next to an active space, merged into it
+    for (int i = 0; i < OBJECTS; i += 2) {
+        my_free(objects[i]);
+        objects[i] = 0;
+    }
+    void *active[NUMBER_OF_POOLS];
+    for (int pool = 0; pool < NUMBER_OF_POOLS; ++pool) {
+        active[pool] = activeSpaces[pool];
+    }
+    CHECK(active[0] && active[MY_SHORT_LIVED] && active[MY_LONG_LIVED]);
+    checkSpaces();
+
+    my_alloc_set_placement(MY_PLACEMENT_BUCKETS);
+    int count = checkSpaces();
+    for (int pool = 0; pool < NUMBER_OF_POOLS; ++pool) {
+        CHECK(!activeSpaces[pool]);
+        if (active[pool]) {
+            uint32_t s = headerOf(active[pool])->tailingObjectSize;
+            CHECK(s & 1 && poolOf(s) == (uint32_t) pool && isListed(active[pool], count));
+        }
+    }
+}
+
+// Back and forth while objects come and go, in all pools
+static void switchUnderChurn() {
+    unsigned short state[3] = {1, 2, 3};
+    for (int round = 0; round < ROUNDS; ++round) {
+        my_alloc_set_placement(round & 1 ? MY_PLACEMENT_BUCKETS : MY_PLACEMENT_LOCAL);
+        for (int k = 0; k < OBJECTS; ++k) {
+            int i = (int) (nrand48(state) % OBJECTS);
+            if (objects[i]) {
+                my_free(objects[i]);
+                objects[i] = 0;
+            } else {
+                objects[i] = my_alloc_hint(sizeOf(i), i % 3);
+                CHECK(objects[i]);
+            }
+        }
+        checkSpaces();
+    }
+}
+
+int main() {
+    testCase cases[] = {
+            {"placement: next to each other", nextToEachOther},
+            {"placement: switch retires active", switchRetiresActiveSpaces},
+            {"placement: switch under churn", switchUnderChurn},
+            {0, 0},
+    };
+    return runCases(cases);
+}
@@ -0,0 +1,139 @@
+#include <signal.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// Heap profiler: the dump lists the sampled objects that are still alive, merged by call stack, in the text format
+// pprof reads.
+
+#define OBJECTS 10000
+#define OBJECT_SIZE 104
+#define RATE 4096
+#define SPAN_SIZE (4 * BLOCKSIZE)
+
+static void *objects[OBJECTS];
+static char path[] = "/tmp/profile.XXXXXX";
+
+static int isSampled(void *object) {
+    return isSpanObject(object) ? spanSampled(object) : (footerOf(object)->precedingObjectSize & SAMPLED) != 0;
+}
+
+static void makePath() {
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+}
+
+// Reads the totals of the dump and checks that the stacks add up to them
+static void readProfile(size_t *count, size_t *bytes) {
+    FILE *in = fopen(path, "r");
+    CHECK(in);
+    char line[4096];
+    size_t rate;
+    CHECK(fgets(line, sizeof(line), in));
+    CHECK(sscanf(line, "heap profile: %zu: %zu [%*u: %*u] @ heap_v2/%zu", count, bytes, &rate) == 3);
+    CHECK(rate == RATE);
+    size_t n, b, stackCount = 0, stackBytes = 0;
+    while (fgets(line, sizeof(line), in) && strcmp(line, "\n") != 0) {
+        CHECK(sscanf(line, "%zu: %zu [%*u: %*u] @ 0x", &n, &b) == 2);
+        stackCount += n;
+        stackBytes += b;
+    }
+    CHECK(stackCount == *count && stackBytes == *bytes);
+    CHECK(fgets(line, sizeof(line), in) && strcmp(line, "MAPPED_LIBRARIES:\n") == 0);
+    fclose(in);
+}
+
+static size_t allocateSampled() {
+    size_t sampled = 0;
+    for (int i = 0; i < OBJECTS; ++i) {
+        objects[i] = my_alloc(OBJECT_SIZE);
+        CHECK(objects[i]);
+        sampled += isSampled(objects[i]);
+    }
+    return sampled;
+}
+
+static void liveSamples() {
+    makePath();
+    CHECK(my_alloc_profile_start(RATE, 0) == 0);
+    size_t sampled = allocateSampled();
+    // About one per RATE bytes
+    CHECK(sampled > OBJECTS * OBJECT_SIZE / RATE / 2 && sampled < OBJECTS * OBJECT_SIZE / RATE * 2);
+    size_t count, bytes;
+    CHECK(my_alloc_profile_dump(path) == 0);
+    readProfile(&count, &bytes);
+    CHECK(count == sampled && bytes == sampled * OBJECT_SIZE);
+
+    // Freed objects leave the profile
+    size_t freed = 0;
+    for (int i = 0; i < OBJECTS; i += 2) {
+        freed += isSampled(objects[i]);
+        my_free(objects[i]);
+    }
+    CHECK(freed > 0);
+    CHECK(my_alloc_profile_dump(path) == 0);
+    readProfile(&count, &bytes);
+    unlink(path);
+    CHECK(count == sampled - freed);
+}
+
+static void spanSamples() {
+    makePath();
+    CHECK(my_alloc_profile_start(RATE, 0) == 0);
+    void *span = my_alloc(SPAN_SIZE);
+    CHECK(span && isSpanObject(span) && isSampled(span));
+    size_t count, bytes;
+    CHECK(my_alloc_profile_dump(path) == 0);
+    readProfile(&count, &bytes);
+    CHECK(count == 1 && bytes == SPAN_SIZE);
+    my_free(span);
+    CHECK(my_alloc_profile_dump(path) == 0);
+    readProfile(&count, &bytes);
+    unlink(path);
+    CHECK(count == 0 && bytes == 0);
+}
+
+static void stopSampling() {
+    makePath();
+    CHECK(my_alloc_profile_start(RATE, 0) == 0);
+    size_t sampled = allocateSampled();
+    my_alloc_profile_stop();
+    for (int i = 0; i < OBJECTS; ++i) {
+        CHECK(!isSampled(my_alloc(OBJECT_SIZE)));
+    }
+    // The objects sampled before stay
+    size_t count, bytes;
+    CHECK(my_alloc_profile_dump(path) == 0);
+    readProfile(&count, &bytes);
+    unlink(path);
+    CHECK(count == sampled);
+}
+
+// SIGUSR2 has the next sampled allocation write the profile
+static void dumpOnSignal() {
+    makePath();
+    unlink(path);
+    CHECK(my_alloc_profile_start(RATE, path) == 0);
+    raise(SIGUSR2);
+    struct stat st;
+    CHECK(stat(path, &st) < 0);
+    allocateSampled();
+    size_t count, bytes;
+    readProfile(&count, &bytes);
+    unlink(path);
+    CHECK(count == 0 && bytes == 0);
+}
+
+int main() {
+    testCase cases[] = {
+            {"profile: live samples", liveSamples},
+            {"profile: span samples", spanSamples},
+            {"profile: stop sampling", stopSampling},
+            {"profile: dump on signal", dumpOnSignal},
+            {0, 0},
+    };
+    return runCases(cases);
+}
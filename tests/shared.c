@@ -0,0 +1,225 @@
+#include <errno.h>
+#include <signal.h>
+
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// Shared heap: objects one process allocates are seen, freed and replaced by another.
+// The other processes below are forked after the heap was created, as the API requires for sharing without a socket.
+
+#define HEAP_SIZE ((size_t) 16 << 20)
+#define SMALL_HEAP_SIZE ((size_t) 1 << 20)
+#define OBJECTS 500
+#define MAX_OBJECTS (SMALL_HEAP_SIZE / 8)
+
+static my_heap *heap;
+// Lives in the shared heap, so children can answer through it. Objects of a shared heap fit on a page.
+static uint64_t **slots;
+// Copied into the children on fork, written by the parent only
+static uint64_t *objects[MAX_OBJECTS];
+static int count;
+
+static size_t sizeOf(uint64_t value) {
+    return 8 + value % 61 * 8;
+}
+
+static uint64_t *allocValue(my_heap *h, uint64_t value) {
+    uint64_t *object = my_heap_alloc(h, sizeOf(value));
+    CHECK(object);
+    for (size_t k = 0; k < sizeOf(value) / 8; ++k) {
+        object[k] = value + k;
+    }
+    return object;
+}
+
+static void verifyValue(uint64_t *object, uint64_t value) {
+    for (size_t k = 0; k < sizeOf(value) / 8; ++k) {
+        CHECK(object[k] == value + k);
+    }
+}
+
+static void createHeap(size_t size) {
+    heap = my_heap_shared_create(size);
+    CHECK(heap);
+    slots = my_heap_alloc(heap, OBJECTS * sizeof(uint64_t *));
+    CHECK(slots);
+}
+
+// Replaces the objects of the parent with objects of its own
+static void replaceObjects() {
+    for (int i = 0; i < OBJECTS; ++i) {
+        verifyValue(slots[i], i);
+        my_heap_free(heap, slots[i]);
+        slots[i] = allocValue(heap, OBJECTS + i);
+    }
+    // Its own pages stay apart from the shared heap
+    CHECK(my_alloc(PAGE_SPACE));
+}
+
+static void visibleAcrossFork() {
+    createHeap(HEAP_SIZE);
+    for (int i = 0; i < OBJECTS; ++i) {
+        slots[i] = allocValue(heap, i);
+        CHECK(my_heap_pointer(heap, my_heap_offset(heap, slots[i])) == slots[i]);
+    }
+    CHECK(inChild(replaceObjects));
+    for (int i = 0; i < OBJECTS; ++i) {
+        verifyValue(slots[i], OBJECTS + i);
+        my_heap_free(heap, slots[i]);
+    }
+    // A second one while the first is there
+    CHECK(!my_heap_shared_create(SMALL_HEAP_SIZE) && errno == EBUSY);
+    my_heap_destroy(heap);
+    CHECK(my_heap_shared_create(SMALL_HEAP_SIZE));
+}
+
+// Leaves the inherited heap and comes back through the descriptor, like an unrelated process would
+static void attach() {
+    int fd = dup(my_heap_shared_fd(heap));
+    CHECK(fd >= 0);
+    size_t offset = my_heap_offset(heap, slots);
+    my_heap_destroy(heap);
+    my_heap *h = my_heap_shared_attach(fd);
+    CHECK(h);
+    uint64_t **attachedSlots = my_heap_pointer(h, offset);
+    CHECK(attachedSlots == slots);
+    verifyValue(attachedSlots[0], 1);
+    my_heap_free(h, attachedSlots[0]);
+    attachedSlots[0] = allocValue(h, 2);
+    my_heap_destroy(h);
+}
+
+static void attachByDescriptor() {
+    createHeap(HEAP_SIZE);
+    slots[0] = allocValue(heap, 1);
+    CHECK(inChild(attach));
+    verifyValue(slots[0], 2);
+}
+
+static void freeAll() {
+    for (int i = 0; i < count; ++i) {
+        verifyValue(objects[i], i);
+        my_heap_free(heap, objects[i]);
+    }
+}
+
+// The heap never grows, space freed by another process is taken again
+static void fullHeap() {
+    createHeap(SMALL_HEAP_SIZE);
+    count = 0;
+    while (count < (int) MAX_OBJECTS && (objects[count] = my_heap_alloc(heap, sizeOf(count)))) {
+        for (size_t k = 0; k < sizeOf(count) / 8; ++k) {
+            objects[count][k] = count + k;
+        }
+        ++count;
+    }
+    CHECK(count > 0 && count < (int) MAX_OBJECTS);
+    CHECK(my_alloc(PAGE_SPACE));
+    CHECK(inChild(freeAll));
+    for (int i = 0; i < count; ++i) {
+        CHECK(my_heap_alloc(heap, sizeOf(i)));
+    }
+}
+
+// Fills the heap with objects of their index, returns how many fit
+static int fill() {
+    count = 0;
+    while (count < (int) MAX_OBJECTS && (objects[count] = my_heap_alloc(heap, sizeOf(count)))) {
+        for (size_t k = 0; k < sizeOf(count) / 8; ++k) {
+            objects[count][k] = count + k;
+        }
+        ++count;
+    }
+    return count;
+}
+
+// Pages of the heap that are free, each taken and given back whole
+static int freePages() {
+    int pages = 0;
+    while (pages < (int) MAX_OBJECTS && (objects[pages] = my_heap_alloc(heap, PAGE_SPACE))) {
+        ++pages;
+    }
+    for (int i = 0; i < pages; ++i) {
+        my_heap_free(heap, objects[i]);
+    }
+    return pages;
+}
+
+// Runs function in a child that is killed while it holds the lock of the heap
+static void killedHoldingLock(void (*function)()) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        heapLists = &heap->lists;
+        CHECK(enterShared(heap->shared) == 0);
+        function();
+        raise(SIGKILL);
+    }
+    int status;
+    CHECK(pid > 0 && waitpid(pid, &status, 0) == pid && WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL);
+}
+
+// Dies in the middle of a free: the space of objects[0] is out of its list, objects[1] is free in its tags but not
+// merged with its free neighbours, nor listed
+static void dieFreeing() {
+    removeFreeSpaceFromList((doublePointer *) objects[0]);
+    uint32_t tag = headerOf(objects[1])->tailingObjectSize;
+    headerOf(objects[1])->tailingObjectSize = tag | 1;
+    footerOf(objects[1])->precedingObjectSize = realSize(tag) | 1;
+}
+
+// The next process to take the lock puts the lists right, nothing is lost
+static void lockHolderKilled() {
+    heap = my_heap_shared_create(SMALL_HEAP_SIZE);
+    CHECK(heap);
+    int pages = freePages();
+    CHECK(pages > 0);
+    CHECK(fill() > 3 && count < (int) MAX_OBJECTS);
+    CHECK(objects[1] == (void *) objects[0] + sizeOf(0) + sizeof(header));
+    CHECK(objects[2] == (void *) objects[1] + sizeOf(1) + sizeof(header));
+    for (int i = 0; i < count; i += 2) {
+        my_heap_free(heap, objects[i]);
+    }
+    killedHoldingLock(dieFreeing);
+
+    for (int i = 3; i < count; i += 2) {
+        verifyValue(objects[i], i);
+        my_heap_free(heap, objects[i]);
+    }
+    CHECK(freePages() == pages);
+    CHECK(fill() == count);
+}
+
+// Dies leaving tags that don't add up
+static void dieBreakingTags() {
+    headerOf(objects[1])->tailingObjectSize += 8;
+}
+
+static void unusable() {
+    CHECK(!my_heap_alloc(heap, 8) && errno == ENOTRECOVERABLE);
+}
+
+// The heap fails in every process from then on
+static void brokenByLockHolder() {
+    heap = my_heap_shared_create(SMALL_HEAP_SIZE);
+    CHECK(heap && fill() > 1);
+    killedHoldingLock(dieBreakingTags);
+    unusable();
+    my_heap_free(heap, objects[0]);
+    CHECK(inChild(unusable));
+    unusable();
+    CHECK(my_alloc(PAGE_SPACE));
+}
+
+int main() {
+    testCase cases[] = {
+            {"shared: visible across fork", visibleAcrossFork},
+            {"shared: attach by descriptor", attachByDescriptor},
+            {"shared: full heap", fullHeap},
+            {"shared: lock holder killed", lockHolderKilled},
+            {"shared: broken by lock holder", brokenByLockHolder},
+            {0, 0},
+    };
+    return runCases(cases);
+}
@@ -0,0 +1,121 @@
+#include <string.h>
+
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// Size classes from a histogram: built against the table mysizes generated from MY_SIZES_HISTOGRAM, the way a
+// deployment tunes the allocator to its workload. The table keeps the slack of the recorded requests within the
+// default target of mysizes, and the allocator works on it.
+
+#define MAX_SIZES 100
+// Default -f of mysizes, in percent of the requested bytes
+#define TARGET 1.0
+#define OBJECTS 3000
+
+static uint32_t sizes[MAX_SIZES];
+static double counts[MAX_SIZES];
+static int numberOfSizes;
+static void *objects[OBJECTS];
+
+static void readHistogram() {
+    FILE *f = fopen(MY_SIZES_HISTOGRAM, "r");
+    CHECK(f);
+    char line[256];
+    numberOfSizes = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#') {
+            continue;
+        }
+        CHECK(numberOfSizes < MAX_SIZES);
+        CHECK(sscanf(line, "%u %lf", &sizes[numberOfSizes], &counts[numberOfSizes]) == 2);
+        CHECK(sizes[numberOfSizes] % 8 == 0 && sizes[numberOfSizes] <= SIZE_CLASS_LIMIT);
+        numberOfSizes++;
+    }
+    fclose(f);
+    CHECK(numberOfSizes > 0);
+}
+
+// Size a request is sure to find a space of in its list, or in the lists above it
+static uint32_t roundUp(uint32_t size) {
+    int list = bucketIndex(size);
+    return sizeClassStart[list] == size ? size : sizeClassStart[list + 1];
+}
+
+static void tableFitsHistogram() {
+    readHistogram();
+    // Fewer lists than sizes, the first one for the smallest
+    CHECK(NUMBER_OF_LISTS <= numberOfSizes + 1 && sizeClassStart[0] == 8);
+    CHECK(sizeClassStart[NUMBER_OF_LISTS] == SIZE_CLASS_LIMIT + 8);
+    for (uint32_t size = 8; size <= SIZE_CLASS_LIMIT; size += 8) {
+        int list = bucketIndex(size);
+        CHECK(sizeClassStart[list] <= size && size < sizeClassStart[list + 1]);
+    }
+
+    double requested = 0;
+    double slack = 0;
+    for (int i = 0; i < numberOfSizes; ++i) {
+        requested += counts[i] * sizes[i];
+        slack += counts[i] * (roundUp(sizes[i]) - sizes[i]);
+    }
+    CHECK(slack <= TARGET / 100 * requested);
+}
+
+// Objects of the recorded sizes, as often as recorded
+static uint32_t sizeOf(int i) {
+    double total = 0;
+    for (int k = 0; k < numberOfSizes; ++k) {
+        total += counts[k];
+    }
+    double n = (double) i / OBJECTS * total;
+    int k = 0;
+    while (k < numberOfSizes - 1 && n >= counts[k]) {
+        n -= counts[k++];
+    }
+    return sizes[k];
+}
+
+static void allocatorOnTable() {
+    readHistogram();
+    for (int i = 0; i < OBJECTS; ++i) {
+        objects[i] = my_alloc(sizeOf(i));
+        CHECK(objects[i]);
+        memset(objects[i], i, sizeOf(i));
+    }
+    for (int i = 0; i < OBJECTS; i += 2) {
+        my_free(objects[i]);
+    }
+    // Taken from the lists again
+    for (int i = 0; i < OBJECTS; i += 2) {
+        objects[i] = my_alloc(sizeOf(i));
+        CHECK(objects[i]);
+        memset(objects[i], i, sizeOf(i));
+    }
+    for (int i = 0; i < OBJECTS; ++i) {
+        unsigned char *p = objects[i];
+        CHECK(p[0] == (unsigned char) i && p[sizeOf(i) - 1] == (unsigned char) i);
+    }
+
+    // A space freed between live objects heads its list, and a request of the size starting the list takes it
+    int reused = 0;
+    for (int i = 1; i < OBJECTS; i += 2) {
+        uint32_t size = sizeOf(i);
+        if (size == sizeClassStart[bucketIndex(size)] && !isBitmapObject(objects[i]) &&
+            realSize(headerOf(objects[i])->tailingObjectSize) == size &&
+            !(headerOf(objects[i])->precedingObjectSize & 1) && !(footerOf(objects[i])->tailingObjectSize & 1)) {
+            my_free(objects[i]);
+            CHECK(defaultLists.buckets[0][bucketIndex(size)] == objects[i]);
+            CHECK(my_alloc(size) == objects[i]);
+            ++reused;
+        }
+    }
+    CHECK(reused > 0);
+}
+
+int main() {
+    testCase cases[] = {
+            {"sizes: table fits histogram", tableFitsHistogram},
+            {"sizes: allocator on table", allocatorOnTable},
+            {0, 0},
+    };
+    return runCases(cases);
+}
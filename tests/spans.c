@@ -0,0 +1,91 @@
+#include <string.h>
+
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// Spans: objects larger than a page get whole blocks out of runs of adjacent blocks. Freed spans coalesce with their
+// neighbours and are taken again before the runs grow.
+
+#define SPANS 40
+#define HEADER 16
+
+static void *objects[SPANS];
+
+static size_t blocksOf(size_t size) {
+    return (size + HEADER + BLOCKSIZE - 1) / BLOCKSIZE;
+}
+
+static size_t sizeOf(int i) {
+    return PAGE_SPACE + 8 + (size_t) i * 13 * BLOCKSIZE % (SPAN_MAX_SIZE - PAGE_SPACE) / 8 * 8;
+}
+
+static void checkSpan(void *span, size_t size, int value) {
+    unsigned char *p = span;
+    CHECK(p[0] == (unsigned char) value && p[size / 2] == (unsigned char) value);
+    CHECK(p[size - 1] == (unsigned char) value);
+}
+
+static void sizes() {
+    for (int i = 0; i < SPANS; ++i) {
+        objects[i] = my_alloc(sizeOf(i));
+        CHECK(objects[i] && isSpanObject(objects[i]));
+        memset(objects[i], i, sizeOf(i));
+    }
+    CHECK(my_alloc(SPAN_MAX_SIZE) && !my_alloc(SPAN_MAX_SIZE + 8));
+    for (int i = 0; i < SPANS; ++i) {
+        checkSpan(objects[i], sizeOf(i), i);
+    }
+    // In any order, everything coalesces back into free runs
+    for (int i = 0; i < SPANS; i += 2) {
+        my_free(objects[i]);
+    }
+    for (int i = SPANS - 1; i > 0; i -= 2) {
+        my_free(objects[i]);
+    }
+    CHECK(allocStats->freeSpanBlocks + blocksOf(SPAN_MAX_SIZE) == allocStats->spanBlocks);
+}
+
+static void freedSpansReused() {
+    for (int i = 0; i < SPANS; ++i) {
+        objects[i] = my_alloc(2 * BLOCKSIZE);
+        CHECK(objects[i]);
+    }
+    uint64_t spanBlocks = allocStats->spanBlocks;
+    for (int i = 0; i < SPANS; i += 2) {
+        my_free(objects[i]);
+    }
+    for (int i = 0; i < SPANS; i += 2) {
+        void *span = my_alloc(2 * BLOCKSIZE);
+        int found = 0;
+        for (int j = 0; j < SPANS; j += 2) {
+            found |= objects[j] == span;
+        }
+        CHECK(found);
+    }
+    CHECK(allocStats->spanBlocks == spanBlocks);
+}
+
+static void neighboursCoalesce() {
+    char *a = my_alloc(BLOCKSIZE);
+    char *b = my_alloc(2 * BLOCKSIZE);
+    char *c = my_alloc(3 * BLOCKSIZE);
+    // Carved from the same run one after the other
+    CHECK(b == a + 2 * BLOCKSIZE && c == b + 3 * BLOCKSIZE);
+    CHECK(my_alloc(BLOCKSIZE));
+    uint64_t spanBlocks = allocStats->spanBlocks;
+    my_free(a);
+    my_free(c);
+    my_free(b);
+    CHECK(my_alloc(9 * BLOCKSIZE - HEADER) == a);
+    CHECK(allocStats->spanBlocks == spanBlocks);
+}
+
+int main() {
+    testCase cases[] = {
+            {"spans: sizes", sizes},
+            {"spans: freed spans reused", freedSpansReused},
+            {"spans: neighbours coalesce", neighboursCoalesce},
+            {0, 0},
+    };
+    return runCases(cases);
+}
@@ -0,0 +1,88 @@
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// Counters: kept up to date on every operation, and seen by other processes once exported to shared memory.
+
+#define OBJECTS 5000
+
+static void *objects[OBJECTS];
+static char name[64];
+static char otherName[64];
+
+// Maps the exported counters the way mystat does
+static const struct my_alloc_stats *attach(const char *n) {
+    int fd = shm_open(n, O_RDONLY, 0);
+    CHECK(fd >= 0);
+    const struct my_alloc_stats *stats = mmap(0, sizeof(struct my_alloc_stats), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    CHECK(stats != MAP_FAILED);
+    return stats;
+}
+
+static void allocateSome() {
+    for (int i = 0; i < OBJECTS; ++i) {
+        objects[i] = my_alloc_hint(8 + (size_t) i * 8 % 3000, i % 3);
+        CHECK(objects[i]);
+    }
+    for (int i = 0; i < OBJECTS; i += 2) {
+        my_free(objects[i]);
+    }
+}
+
+// The free lists hold as many spaces as counted
+static void countsMatchLists() {
+    allocateSome();
+    // Taken from the lists again
+    for (int i = 0; i < OBJECTS; i += 2) {
+        CHECK(my_alloc_hint(8 + (size_t) i * 8 % 3000 / 16 * 8, i % 3));
+    }
+    struct my_alloc_stats counted = *allocStats;
+    countFreeSpaces();
+    CHECK(memcmp(counted.freeSpaces, allocStats->freeSpaces, sizeof(counted.freeSpaces)) == 0);
+    CHECK(counted.emptyPages == allocStats->emptyPages);
+    CHECK(counted.allocations == OBJECTS + OBJECTS / 2 && counted.frees == OBJECTS / 2);
+}
+
+static void readExported() {
+    const struct my_alloc_stats *stats = attach(name);
+    CHECK(stats->magic == MY_ALLOC_STATS_MAGIC && stats->pid == getppid());
+    CHECK(stats->allocations == OBJECTS + 1 && stats->frees == OBJECTS / 2);
+}
+
+static void exported() {
+    snprintf(name, sizeof(name), "/myalloc-test.%d", getpid());
+    allocateSome();
+    CHECK(my_alloc_stats_export(name) == 0);
+    const struct my_alloc_stats *stats = attach(name);
+    CHECK(stats->magic == MY_ALLOC_STATS_MAGIC && stats->pid == getpid());
+    CHECK(stats->blockSize == BLOCKSIZE && stats->pools == NUMBER_OF_POOLS && stats->lists == NUMBER_OF_LISTS);
+    // Counted before the export
+    CHECK(stats->allocations == OBJECTS && stats->frees == OBJECTS / 2);
+    CHECK(stats->liveBytes > 0 && stats->blocksTaken > 0);
+    // And after
+    CHECK(my_alloc(200));
+    CHECK(stats->allocations == OBJECTS + 1);
+    CHECK(inChild(readExported));
+
+    // Moved to another name, the first one keeps the last values
+    snprintf(otherName, sizeof(otherName), "/myalloc-test2.%d", getpid());
+    CHECK(my_alloc_stats_export(otherName) == 0);
+    CHECK(my_alloc(200));
+    const struct my_alloc_stats *other = attach(otherName);
+    shm_unlink(name);
+    shm_unlink(otherName);
+    CHECK(other->allocations == OBJECTS + 2 && stats->allocations == OBJECTS + 1);
+}
+
+int main() {
+    testCase cases[] = {
+            {"stats: counts match lists", countsMatchLists},
+            {"stats: exported", exported},
+            {0, 0},
+    };
+    return runCases(cases);
+}
@@ -0,0 +1,161 @@
+#include <pthread.h>
+#include <string.h>
+
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// my_alloc_threadsafe: threads allocate and free concurrently, also objects another thread allocated, without
+// handing out an object twice or losing count of them.
+
+#define THREADS 4
+#define INCREMENTS 200000
+#define OBJECTS 200000
+#define QUEUE_SIZE 256
+#define SLOTS 1024
+#define OPERATIONS 100000
+
+typedef struct queue {
+    void *objects[QUEUE_SIZE];
+    uint64_t head;
+    uint64_t tail;
+} queue;
+
+static int lock;
+static uint64_t counter;
+static queue queues[THREADS / 2];
+static void *slots[SLOTS];
+
+static size_t sizeOf(uint64_t value) {
+    return 8 + value * 40503 % 2000 / 8 * 8;
+}
+
+// Writes value into every word of an object of its size
+static void *allocValue(uint64_t value) {
+    uint64_t *object = my_alloc(sizeOf(value));
+    CHECK(object);
+    for (size_t k = 0; k < sizeOf(value) / 8; ++k) {
+        object[k] = value;
+    }
+    return object;
+}
+
+// An object handed out twice holds the value of the other thread in some word
+static void freeValue(uint64_t *object) {
+    uint64_t value = object[0];
+    for (size_t k = 1; k < sizeOf(value) / 8; ++k) {
+        CHECK(object[k] == value);
+    }
+    my_free(object);
+}
+
+static void *increment() {
+    for (int i = 0; i < INCREMENTS; ++i) {
+        spinLock(&lock);
+        // Not atomic, two threads in here lose increments
+        counter = counter + 1;
+        __atomic_store_n(&lock, 0, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+static void spinLockExcludes() {
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; ++i) {
+        CHECK(pthread_create(&threads[i], 0, increment, 0) == 0);
+    }
+    for (int i = 0; i < THREADS; ++i) {
+        pthread_join(threads[i], 0);
+    }
+    CHECK(counter == (uint64_t) THREADS * INCREMENTS);
+}
+
+static void *produce(void *q) {
+    queue *to = q;
+    for (uint64_t i = 0; i < OBJECTS; ++i) {
+        while (i - __atomic_load_n(&to->head, __ATOMIC_ACQUIRE) == QUEUE_SIZE) {
+            sched_yield();
+        }
+        // Values of all producers differ
+        to->objects[i % QUEUE_SIZE] = allocValue((i << 8) + (uint64_t) (to - queues));
+        __atomic_store_n(&to->tail, i + 1, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+static void *consume(void *q) {
+    queue *from = q;
+    for (uint64_t i = 0; i < OBJECTS; ++i) {
+        while (__atomic_load_n(&from->tail, __ATOMIC_ACQUIRE) == i) {
+            sched_yield();
+        }
+        freeValue(from->objects[i % QUEUE_SIZE]);
+        __atomic_store_n(&from->head, i + 1, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+// Objects are freed by another thread than the one that allocated them
+static void crossThreadFrees() {
+    my_alloc_threadsafe(1);
+    struct my_alloc_stats before = *allocStats;
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS / 2; ++i) {
+        CHECK(pthread_create(&threads[2 * i], 0, produce, &queues[i]) == 0);
+        CHECK(pthread_create(&threads[2 * i + 1], 0, consume, &queues[i]) == 0);
+    }
+    for (int i = 0; i < THREADS; ++i) {
+        pthread_join(threads[i], 0);
+    }
+    CHECK(allocStats->allocations == before.allocations + (uint64_t) THREADS / 2 * OBJECTS);
+    CHECK(allocStats->frees == before.frees + (uint64_t) THREADS / 2 * OBJECTS);
+    CHECK(allocStats->liveBytes == before.liveBytes);
+}
+
+// Replaces the objects of random slots, whoever allocated them
+static void *replaceRandom(void *seed) {
+    unsigned short state[3] = {(unsigned short) (uintptr_t) seed, 1, 2};
+    for (uint64_t i = 0; i < OPERATIONS; ++i) {
+        int slot = (int) (nrand48(state) % SLOTS);
+        void *object = __atomic_exchange_n(&slots[slot], 0, __ATOMIC_ACQ_REL);
+        if (object) {
+            freeValue(object);
+        } else {
+            object = allocValue(i << 8 | (uintptr_t) seed);
+            void *empty = 0;
+            // Another thread filled the slot meanwhile
+            if (!__atomic_compare_exchange_n(&slots[slot], &empty, object, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                freeValue(object);
+            }
+        }
+    }
+    return 0;
+}
+
+static void sharedPool() {
+    my_alloc_threadsafe(1);
+    struct my_alloc_stats before = *allocStats;
+    pthread_t threads[THREADS];
+    for (uintptr_t i = 0; i < THREADS; ++i) {
+        CHECK(pthread_create(&threads[i], 0, replaceRandom, (void *) i) == 0);
+    }
+    for (int i = 0; i < THREADS; ++i) {
+        pthread_join(threads[i], 0);
+    }
+    for (int i = 0; i < SLOTS; ++i) {
+        if (slots[i]) {
+            freeValue(slots[i]);
+        }
+    }
+    CHECK(allocStats->allocations - before.allocations == allocStats->frees - before.frees);
+    CHECK(allocStats->liveBytes == before.liveBytes);
+}
+
+int main() {
+    testCase cases[] = {
+            {"threads: spinlock excludes", spinLockExcludes},
+            {"threads: cross-thread frees", crossThreadFrees},
+            {"threads: shared pool", sharedPool},
+            {0, 0},
+    };
+    return runCases(cases);
+}
@@ -0,0 +1,117 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "my_alloc_internal.h"
+#include "check.h"
+
+// Event tracer: the records in the file tell what the allocator did, in order, the way mytrace decodes them.
+
+#define OBJECT_SIZE 200
+#define RING_RECORDS 16
+
+static char path[] = "/tmp/trace.XXXXXX";
+
+static void startTrace(size_t records) {
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+    CHECK(my_alloc_trace_start(path, records) == 0);
+}
+
+// Maps the trace file after tracing stopped
+static const struct my_alloc_trace_header *openTrace() {
+    int fd = open(path, O_RDONLY);
+    CHECK(fd >= 0);
+    struct stat st;
+    CHECK(fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(struct my_alloc_trace_header));
+    const struct my_alloc_trace_header *h = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    unlink(path);
+    CHECK(h != MAP_FAILED);
+    CHECK(h->magic == MY_ALLOC_TRACE_MAGIC && h->recordSize == sizeof(struct my_alloc_trace_record));
+    CHECK(h->pid == getpid() && h->stopNs >= h->startNs && h->stopNs > 0);
+    CHECK((size_t) st.st_size == sizeof(*h) + h->capacity * sizeof(struct my_alloc_trace_record));
+    return h;
+}
+
+static const struct my_alloc_trace_record *record(const struct my_alloc_trace_header *h, uint64_t n) {
+    return (const struct my_alloc_trace_record *) (h + 1) + (n & (h->capacity - 1));
+}
+
+// Index of the first record of event at address from record n on, -1 if there is none
+static int64_t find(const struct my_alloc_trace_header *h, uint64_t n, int event, void *address) {
+    for (; n < h->written; ++n) {
+        if (record(h, n)->event == event && record(h, n)->address == (uintptr_t) address) {
+            return (int64_t) n;
+        }
+    }
+    return -1;
+}
+
+static void events() {
+    startTrace(0);
+    void *object = my_alloc(OBJECT_SIZE);
+    void *small = my_alloc(16);
+    void *span = my_alloc(3 * BLOCKSIZE);
+    CHECK(object && small && span);
+    my_free(object);
+    my_free(small);
+    my_free(span);
+    my_alloc_set_budget(allocStats->blocksTaken * BLOCKSIZE);
+    int pages = 0;
+    while (pages < 1000 && my_alloc(PAGE_SPACE)) {
+        ++pages;
+    }
+    CHECK(pages < 1000);
+    my_alloc_trace_stop();
+
+    const struct my_alloc_trace_header *h = openTrace();
+    int64_t alloc = find(h, 0, MY_TRACE_ALLOC, object);
+    CHECK(alloc >= 0);
+    CHECK(record(h, alloc)->size == OBJECT_SIZE && record(h, alloc)->pool == 0);
+    CHECK(record(h, alloc)->bucket == bucketIndex(OBJECT_SIZE));
+    int64_t freed = find(h, alloc, MY_TRACE_FREE, object);
+    CHECK(freed > alloc && record(h, freed)->size == OBJECT_SIZE);
+
+    alloc = find(h, 0, MY_TRACE_ALLOC, small);
+    CHECK(alloc >= 0 && record(h, alloc)->pool == MY_TRACE_BITMAP && record(h, alloc)->size == 16);
+    CHECK(find(h, alloc, MY_TRACE_FREE, small) > alloc);
+
+    alloc = find(h, 0, MY_TRACE_ALLOC, span);
+    CHECK(alloc >= 0 && record(h, alloc)->pool == MY_TRACE_SPAN && record(h, alloc)->size >= 3 * BLOCKSIZE);
+    CHECK(find(h, 0, MY_TRACE_NEW_PAGE, span - 16) >= 0);
+    CHECK(find(h, alloc, MY_TRACE_FREE, span) > alloc);
+
+    int outOfMemory = 0;
+    for (uint64_t n = 0; n < h->written; ++n) {
+        CHECK(record(h, n)->event > 0 && record(h, n)->event < MY_TRACE_EVENTS);
+        outOfMemory |= record(h, n)->event == MY_TRACE_OUT_OF_MEMORY;
+    }
+    CHECK(outOfMemory);
+}
+
+// A small ring keeps the last records
+static void ringWraps() {
+    startTrace(RING_RECORDS - 3);
+    void *object = 0;
+    for (int i = 0; i < 100; ++i) {
+        object = my_alloc(OBJECT_SIZE);
+        CHECK(object);
+    }
+    my_free(object);
+    my_alloc_trace_stop();
+
+    const struct my_alloc_trace_header *h = openTrace();
+    CHECK(h->capacity == RING_RECORDS && h->written > 100);
+    CHECK(find(h, h->written - RING_RECORDS, MY_TRACE_FREE, object) >= 0);
+}
+
+int main() {
+    testCase cases[] = {
+            {"trace: events", events},
+            {"trace: ring wraps", ringWraps},
+            {0, 0},
+    };
+    return runCases(cases);
+}